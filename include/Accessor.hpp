@@ -0,0 +1,48 @@
+#ifndef RAYTRACING_ACCESSOR_HPP
+#define RAYTRACING_ACCESSOR_HPP
+
+#include <Gltf.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The elements of a glTF accessor where they lie in their buffer, `stride` bytes apart.
+struct AccessorData {
+	const char *data = nullptr;
+	size_t count = 0;
+	size_t stride = 0;
+	size_t component_type = 0;
+	int components = 0;
+	bool normalized = false;
+};
+
+// Components per element of an accessor type such as "VEC3", 0 for unknown types.
+int accessor_components(const std::string &type);
+// Bytes per component, 0 for unknown component types.
+size_t component_size(size_t component_type);
+
+/*
+ * Locates the accessor's elements, honouring the byteOffset of both the
+ * accessor and its buffer view and the view's byteStride. False if a
+ * reference is out of range, the types are unknown or the elements do not
+ * fit inside the buffer.
+ */
+bool accessor_data(const GltfAccessor &accessor, const std::vector<GltfBufferView> &buffer_views,
+		   const std::vector<GltfBuffer> &buffers, AccessorData &result);
+
+// Whether elements [0, count) already are tightly packed, aligned floats or uint32 indices.
+bool packed_floats(const AccessorData &accessor);
+bool packed_indices(const AccessorData &accessor);
+
+/*
+ * Converts elements [first, first + count) to floats, `components` per
+ * element. Normalized integers map onto [0, 1] or [-1, 1] as the glTF
+ * specification asks; packed floats are copied.
+ */
+void read_floats(const AccessorData &accessor, size_t first, size_t count, float *out);
+// Widens unsigned integer elements [first, first + count) of a scalar accessor to uint32.
+void read_indices(const AccessorData &accessor, size_t first, size_t count, uint32_t *out);
+
+#endif //RAYTRACING_ACCESSOR_HPP
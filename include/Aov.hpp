@@ -0,0 +1,127 @@
+#ifndef RAYTRACING_AOV_HPP
+#define RAYTRACING_AOV_HPP
+
+#include "Color.hpp"
+#include "utils.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+
+// Arbitrary output variables, recorded alongside the radiance of every camera sample.
+enum class Aov {
+	DEPTH,
+	NORMAL,
+	ALBEDO,
+	PRIMITIVE_ID,
+	MATERIAL_ID,
+	EMISSION,
+	DIRECT,
+	INDIRECT,
+	NODE_VISITS,
+	PRIMITIVE_TESTS,
+	AOVS_NUMBER
+};
+
+constexpr uint32_t
+aov_bit(Aov aov)
+{
+	return 1u << (uint32_t)aov;
+}
+
+// Ids are taken from the first sample of a pixel, everything else is averaged over its samples.
+constexpr bool
+aov_is_id(Aov aov)
+{
+	return aov == Aov::PRIMITIVE_ID || aov == Aov::MATERIAL_ID;
+}
+
+inline int
+aov_channels(Aov aov)
+{
+	switch (aov) {
+		case (Aov::NORMAL):
+		case (Aov::ALBEDO):
+		case (Aov::EMISSION):
+		case (Aov::DIRECT):
+		case (Aov::INDIRECT):
+			return 3;
+		case (Aov::DEPTH):
+		case (Aov::PRIMITIVE_ID):
+		case (Aov::MATERIAL_ID):
+		case (Aov::NODE_VISITS):
+		case (Aov::PRIMITIVE_TESTS):
+			return 1;
+		default:
+			unreachable();
+	}
+	return 0;
+}
+
+inline const char *
+aov_name(Aov aov)
+{
+	switch (aov) {
+		case (Aov::DEPTH): return "depth";
+		case (Aov::NORMAL): return "normal";
+		case (Aov::ALBEDO): return "albedo";
+		case (Aov::PRIMITIVE_ID): return "primitive_id";
+		case (Aov::MATERIAL_ID): return "material_id";
+		case (Aov::EMISSION): return "emission";
+		case (Aov::DIRECT): return "direct";
+		case (Aov::INDIRECT): return "indirect";
+		case (Aov::NODE_VISITS): return "node_visits";
+		case (Aov::PRIMITIVE_TESTS): return "primitive_tests";
+		default:
+			unreachable();
+	}
+	return "";
+}
+
+// Work done by all the ray casts of one sample.
+struct TraversalStats {
+	uint32_t node_visits = 0;
+	uint32_t primitive_tests = 0;
+};
+
+/*
+ * Everything a camera sample records besides its radiance. Geometry is taken
+ * at the first hit; direct light is the emission seen by the camera plus the
+ * light arriving at the first hit straight from an emitter, indirect light is
+ * the rest of the path.
+ */
+struct SampleAovs {
+	float depth = 0.f;
+	glm::vec3 normal = {0, 0, 0};
+	Color albedo = {1, 1, 1};
+	float primitive_id = -1.f;
+	float material_id = -1.f;
+	Color emission = {0, 0, 0};
+	Color direct = {0, 0, 0};
+	Color indirect = {0, 0, 0};
+	// Emission found by the second path vertex, splits the first bounce.
+	Color next_emission = {0, 0, 0};
+	TraversalStats traversal;
+
+	glm::vec3
+	get(Aov aov) const
+	{
+		switch (aov) {
+			case (Aov::DEPTH): return glm::vec3(depth, 0.f, 0.f);
+			case (Aov::NORMAL): return normal;
+			case (Aov::ALBEDO): return albedo;
+			case (Aov::PRIMITIVE_ID): return glm::vec3(primitive_id, 0.f, 0.f);
+			case (Aov::MATERIAL_ID): return glm::vec3(material_id, 0.f, 0.f);
+			case (Aov::EMISSION): return emission;
+			case (Aov::DIRECT): return direct;
+			case (Aov::INDIRECT): return indirect;
+			case (Aov::NODE_VISITS): return glm::vec3((float)traversal.node_visits, 0.f, 0.f);
+			case (Aov::PRIMITIVE_TESTS): return glm::vec3((float)traversal.primitive_tests, 0.f, 0.f);
+			default:
+				unreachable();
+		}
+		return glm::vec3(0.f);
+	}
+};
+
+#endif //RAYTRACING_AOV_HPP
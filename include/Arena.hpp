@@ -0,0 +1,79 @@
+#ifndef RAYTRACING_ARENA_HPP
+#define RAYTRACING_ARENA_HPP
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Monotonic allocator over large page-backed chunks. Memory is handed out
+ * uninitialized, is never freed one allocation at a time and stays at its
+ * address when the arena itself is moved. Chunks of 2 MiB and more are
+ * advised to use transparent huge pages.
+ */
+class Arena {
+public:
+	// Position to rewind to; everything allocated after it is dropped together.
+	struct Marker {
+		size_t chunks = 0;
+		size_t used = 0;
+	};
+
+	Arena() = default;
+	Arena(Arena &&other) noexcept;
+	Arena &operator=(Arena &&other) noexcept;
+	Arena(const Arena&) = delete;
+	Arena &operator=(const Arena&) = delete;
+	~Arena();
+
+	void *allocate(size_t size, size_t alignment);
+	template<typename T>
+	T *
+	allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible_v<T>, "arena memory is released without destructors");
+		return (T*)allocate(count * sizeof(T), alignof(T));
+	}
+	// Makes the next `size` bytes come from one chunk, mapped ahead of time.
+	void reserve(size_t size);
+
+	Marker mark() const { return {chunks.size(), used}; }
+	/*
+	 * Unmaps the chunks started after `marker` and reuses the rest of its
+	 * chunk. Rewinding to an empty arena keeps its largest chunk mapped, so
+	 * scopes that come and go every frame do not map and fault in pages anew.
+	 */
+	void rewind(Marker marker);
+
+private:
+	struct Chunk {
+		char *data;
+		size_t size;
+	};
+
+	void add_chunk(size_t size);
+
+	std::vector<Chunk> chunks;
+	size_t used = 0;
+};
+
+// This thread's arena for temporaries of loading, building and refitting.
+Arena &scratch_arena();
+
+// Rewinds this thread's scratch arena to where it was when the scope began.
+class ScratchScope {
+public:
+	ScratchScope() : arena(scratch_arena()), marker(arena.mark()) {}
+	ScratchScope(const ScratchScope&) = delete;
+	ScratchScope &operator=(const ScratchScope&) = delete;
+	~ScratchScope() { arena.rewind(marker); }
+
+	template<typename T>
+	T *allocate(size_t count) { return arena.allocate<T>(count); }
+
+private:
+	Arena &arena;
+	Arena::Marker marker;
+};
+
+#endif //RAYTRACING_ARENA_HPP
@@ -1,6 +1,7 @@
 #ifndef RAYTRACING_BVH_HPP
 #define RAYTRACING_BVH_HPP
 
+#include <Aov.hpp>
 #include <Primitive.hpp>
 #include <utils.hpp>
 
@@ -8,7 +9,6 @@
 #include "glm/glm.hpp"
 
 #include <memory>
-#include <unordered_map>
 #include <vector>
 
 struct AABB {
@@ -23,6 +23,13 @@ struct AABB {
 };
 
 AABB build_aabb(const Primitive* primitive);
+float aabb_surface_area(const AABB &aabb);
+
+// A primitive being sorted into the tree, carried together with its bounds.
+struct BuildItem {
+	const Primitive *primitive;
+	AABB aabb;
+};
 
 struct Node {
 	AABB aabb;
@@ -35,12 +42,26 @@ struct Node {
 struct BVH {
 	BVH() = default;
 	BVH(const std::vector<const Primitive*> &primitives);
-    	int build_node(std::unordered_map<const Primitive*, AABB> &aabbs, int first, int count);
-	std::optional<Intersection> intersect(Ray ray, int current_id = -1, float min_distance = INF, bool debug = false) const;
+    	int build_node(BuildItem *items, float *scores, int first, int count);
+	std::optional<Intersection> intersect(Ray ray, int current_id = -1, float min_distance = INF, bool debug = false,
+					      TraversalStats *stats = nullptr) const;
+	/*
+	 * Recomputes the bounds of the given leaves from their primitives and of
+	 * every ancestor bottom-up, touching only the nodes above those leaves.
+	 */
+	void refit(const std::vector<int> &leaves);
+	// Surface area heuristic cost of the tree relative to its root's area.
+	float sah_cost() const;
+
 	std::vector<Node> nodes;
+	std::vector<int> parents;
 	int root;
+	// Levels below the root; a depth-first walk never holds more than depth + 1 pending nodes.
+	int depth = 0;
 
 	std::vector<const Primitive*> primitives;
+	// Sum of every node's area, leaves weighted by their primitive count.
+	double sah_area = 0.;
 };
 
 #endif //RAYTRACING_BVH_HPP
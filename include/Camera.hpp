@@ -7,6 +7,8 @@
 
 struct Camera {
 	Ray ray_throw(float x, float y) const;
+	// Camera at `position` facing `target`; width, height and tan_fov_* are left for the caller.
+	static Camera look_at(glm::vec3 position, glm::vec3 target, glm::vec3 up, float fov_y);
 
 	int width, height;
 	glm::vec3 position;
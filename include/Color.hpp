@@ -8,7 +8,21 @@ using Color = glm::vec3;
 static auto black = glm::vec3(0, 0, 0);
 
 Color gamma_corrected(const Color &x);
-static Color saturate(const Color &color);
 Color aces_tonemap(const Color &x);
 
+// Per-channel ACES fit (Narkowicz), clamped to [0, 1]. NaN maps to 0 and +Inf to 1.
+inline float
+aces_tonemap(float x)
+{
+	const float a = 2.51f;
+	const float b = 0.03f;
+	const float c = 2.43f;
+	const float d = 0.59f;
+	const float e = 0.14f;
+	// The fit has long saturated here, and Inf would turn into Inf / Inf.
+	x = (x > 1e6f) ? 1e6f : x;
+	const float y = (x * (a * x + b)) / (x * (c * x + d) + e);
+	return !(y > 0.f) ? 0.f : (y < 1.f) ? y : 1.f;
+}
+
 #endif //RAYTRACING_SEMINAR_PRACTICE_COLOR_HPP
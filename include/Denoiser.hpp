@@ -0,0 +1,27 @@
+#ifndef RAYTRACING_DENOISER_HPP
+#define RAYTRACING_DENOISER_HPP
+
+#include "Color.hpp"
+#include "Framebuffer.hpp"
+
+#include <vector>
+
+// AOVs the framebuffer has to record for denoise().
+static const uint32_t denoiser_aovs = aov_bit(Aov::ALBEDO) | aov_bit(Aov::NORMAL) | aov_bit(Aov::DEPTH);
+
+struct DenoiserSettings {
+	int iterations = 5;
+	float sigma_color = 0.1f;
+	float normal_power = 64.f;
+	float sigma_depth = 0.1f;
+	float sigma_albedo = 0.1f;
+};
+
+/*
+ * Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the
+ * first-hit albedo, normal and depth AOVs of the framebuffer. Filters
+ * the albedo-demodulated linear radiance and returns linear radiance.
+ */
+std::vector<Color> denoise(const Framebuffer &framebuffer, const DenoiserSettings &settings = {});
+
+#endif //RAYTRACING_DENOISER_HPP
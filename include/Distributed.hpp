@@ -0,0 +1,28 @@
+#ifndef RAYTRACING_DISTRIBUTED_HPP
+#define RAYTRACING_DISTRIBUTED_HPP
+
+#include "Framebuffer.hpp"
+#include "Job.hpp"
+
+/*
+ * Coordinator side of distributed rendering. The image is cut into square
+ * tiles which are handed to job.options.workers worker processes, each
+ * speaking the worker protocol over its stdin and stdout:
+ *
+ *	-> tile <id> <x0> <y0> <x1> <y1> <samples> <bytes>, followed by the tile's save_tile data
+ *	<- done <id> <bytes>, followed by the save_tile data after <samples> more samples
+ *
+ * Workers are this executable started with --worker, or
+ * job.options.worker_command (run through /bin/sh, e.g. "ssh node raytracing")
+ * followed by the same arguments. Samples are seeded by pixel and index and
+ * workers continue from the tile's current sums, so a tile renders the same
+ * anywhere, resumed or not: tiles of workers that die or exceed
+ * tile_timeout seconds are re-issued, and once the queue is empty idle
+ * workers duplicate stragglers, keeping whichever copy arrives first.
+ */
+bool render_distributed(const RenderJob &job, Framebuffer &framebuffer);
+
+// Entry point of "raytracing --worker <job>".
+int worker_main(int argc, const char *argv[]);
+
+#endif //RAYTRACING_DISTRIBUTED_HPP
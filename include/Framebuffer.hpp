@@ -0,0 +1,52 @@
+#ifndef RAYTRACING_FRAMEBUFFER_HPP
+#define RAYTRACING_FRAMEBUFFER_HPP
+
+#include "Aov.hpp"
+#include "Color.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+// Pixel rectangle [x0, x1) x [y0, y1).
+struct Tile {
+	int x0, y0, x1, y1;
+
+	int area() const { return (x1 - x0) * (y1 - y0); }
+};
+
+/*
+ * Linear radiance accumulated over all samples taken so far, together with
+ * the number of samples per pixel. Checkpoints store the raw sums, so a
+ * resumed render continues the very same floating point additions.
+ */
+struct Framebuffer {
+	Framebuffer(int height, int width, uint32_t aov_mask = 0);
+
+	void add_sample(int pixel, Color color, const SampleAovs *aovs = nullptr);
+	Color get_pixel(int pixel) const;
+	glm::vec3 get_aov(int pixel, Aov aov) const;
+	std::vector<Color> resolve() const;
+	// Interleaved per-pixel values of one AOV, aov_channels(aov) floats per pixel.
+	std::vector<float> resolve_aov(Aov aov) const;
+	bool has_aov(Aov aov) const;
+	uint32_t min_samples() const;
+
+	void save_checkpoint(std::ofstream &out) const;
+	bool load_checkpoint(std::ifstream &in);
+
+	// Raw sums and sample counts of the tile's pixels.
+	std::vector<char> save_tile(const Tile &tile) const;
+	// Overwrites the tile with data saved by save_tile of a framebuffer with the same AOVs.
+	bool load_tile(const std::vector<char> &data, const Tile &tile);
+
+	int m_width, m_height;
+	std::vector<Color> accumulated;
+	std::vector<uint32_t> sample_count;
+
+	// Sums of the enabled AOVs, the others stay empty so disabled ones cost nothing.
+	uint32_t aov_mask;
+	std::vector<float> aovs[(int)Aov::AOVS_NUMBER];
+};
+
+#endif //RAYTRACING_FRAMEBUFFER_HPP
@@ -2,34 +2,99 @@
 #define RAYTRACING_GLTF_HPP
 
 
-#include <Primitive.hpp>
+#include <Color.hpp>
+#include <Material.hpp>
+#include <Meshopt.hpp>
 #include <Transform.hpp>
 
 #include <glm/vec3.hpp>
 #include <glm/geometric.hpp>
 #include <glm/gtc/quaternion.hpp>
 
-#include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
-
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 
-using GltfBuffer = std::vector<char>;
+/*
+ * Bytes of a glTF buffer, read in place from a private mapping of its file
+ * rather than copied into memory, or decoded from a data URI into memory of
+ * its own. Slices share the storage, which stays alive as long as any of
+ * them does.
+ */
+class GltfBuffer {
+public:
+    // Maps the whole file. Writable mappings are copy-on-write and never change the file.
+    bool map(const std::string &path, bool writable = false);
+    // Storage for decoded data, owned by someone who outlives the buffer such as a scene's arena.
+    void assign(char *data, std::size_t length);
+    GltfBuffer slice(std::size_t offset, std::size_t length) const;
+
+    const char *data() const { return m_data; }
+    char *mutable_data() { return m_data; }
+    std::size_t size() const { return m_size; }
+
+private:
+    std::shared_ptr<char> mapping;
+    char *m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+// Where EXT_meshopt_compression keeps a buffer view's compressed bytes, and how to decode them.
+struct GltfMeshoptCompression {
+    std::size_t buffer = 0;
+    std::size_t byte_offset = 0;
+    std::size_t byte_length = 0;
+    std::size_t byte_stride = 0;
+    std::size_t count = 0;
+    // Absent for modes this loader does not know, whose views are left zeroed.
+    std::optional<MeshoptMode> mode = {};
+    MeshoptFilter filter = MeshoptFilter::NONE;
+};
 
 struct GltfBufferView {
-    size_t buffer;
-    size_t byte_length;
-    size_t byte_offset;
+    size_t buffer = 0;
+    size_t byte_length = 0;
+    size_t byte_offset = 0;
+    // 0 for tightly packed elements.
+    size_t byte_stride = 0;
+    std::optional<GltfMeshoptCompression> meshopt = {};
 };
 
 struct GltfAccessor {
-    std::size_t buffer_view;
-    std::size_t count;
-    std::size_t component_type;
+    // SIZE_MAX for accessors without a buffer view, which are not read.
+    std::size_t buffer_view = SIZE_MAX;
+    std::size_t count = 0;
+    std::size_t component_type = 0;
     std::string type;
-    std::size_t byte_offset;
+    std::size_t byte_offset = 0;
+    bool normalized = false;
+};
+
+enum class GltfShapeType {
+    ELLIPSOID,
+    BOX,
+    PLANE
+};
+
+/*
+ * An analytic primitive placed by a node's extras:
+ * {"shape": "ellipsoid" | "box" | "plane", "size": [x, y, z], "normal": [x, y, z],
+ *  "extent": [x, y, z], "material": i}.
+ * `size` holds the radii of an ellipsoid or the half extents of a box, and
+ * `normal` is a plane's normal through the node's origin, both in node space.
+ * `extent` clips a plane to the box of these half extents; axes without a
+ * positive extent stay unbounded.
+ */
+struct GltfShape {
+    std::optional<GltfShapeType> type = {};
+    glm::vec3 size = {1, 1, 1};
+    glm::vec3 normal = {0, 1, 0};
+    glm::vec3 extent = {0, 0, 0};
+    std::size_t material = SIZE_MAX;
 };
 
 struct GltfNode {
@@ -42,6 +107,9 @@ struct GltfNode {
     std::vector<size_t> children;
     std::optional<size_t> parent_node = {};
     Transform total_transition;
+    // Animated itself or below an animated node.
+    bool dynamic = false;
+    GltfShape shape;
 };
 
 struct GltfMaterial {
@@ -53,14 +121,91 @@ struct GltfMaterial {
     static constexpr const float ior = 1.5;
 };
 
+// Absent properties stay out of range and the primitive is skipped.
 struct GltfPrimitive {
-    std::size_t positions;
-    std::size_t indices;
-    std::size_t material;
+    std::size_t positions = SIZE_MAX;
+    std::size_t indices = SIZE_MAX;
+    std::size_t material = SIZE_MAX;
 };
 
 struct GltfMesh {
     std::vector<GltfPrimitive> primitives;
 };
 
+enum class GltfAnimationPath {
+    TRANSLATION,
+    ROTATION,
+    SCALE
+};
+
+enum class GltfInterpolation {
+    LINEAR,
+    STEP,
+    CUBICSPLINE
+};
+
+struct GltfAnimationChannel {
+    std::size_t node;
+    GltfAnimationPath path;
+    GltfInterpolation interpolation;
+    std::vector<float> times;
+    // Vectors, or quaternions as (x, y, z, w); CUBICSPLINE keeps (in-tangent, value, out-tangent) per time.
+    std::vector<glm::vec4> values;
+};
+
+struct GltfBufferSpec {
+    std::string uri;
+    std::size_t byte_length = 0;
+    // Filled by decoding EXT_meshopt_compression views; its uri, if any, is never read.
+    bool fallback = false;
+};
+
+struct GltfAnimationSampler {
+    std::size_t input = SIZE_MAX;
+    std::size_t output = SIZE_MAX;
+    GltfInterpolation interpolation = GltfInterpolation::LINEAR;
+};
+
+// Channels targeting morph weights or no node at all are kept without a path.
+struct GltfAnimationTarget {
+    std::size_t sampler = SIZE_MAX;
+    std::optional<std::size_t> node = {};
+    std::optional<GltfAnimationPath> path = {};
+};
+
+struct GltfAnimation {
+    std::vector<GltfAnimationSampler> samplers;
+    std::vector<GltfAnimationTarget> channels;
+};
+
+// What the scene needs from a glTF file's JSON, read without building a DOM.
+struct GltfDocument {
+    std::vector<GltfBufferSpec> buffers;
+    std::vector<GltfBufferView> buffer_views;
+    std::vector<GltfNode> nodes;
+    std::vector<GltfMesh> meshes;
+    std::vector<GltfAccessor> accessors;
+    std::vector<GltfMaterial> materials;
+    std::vector<GltfAnimation> animations;
+    // Vertical field of view of every camera, absent for orthographic ones.
+    std::vector<std::optional<float>> camera_fovs;
+};
+
+// Bytes encoded by standard base64 text, or SIZE_MAX if its length is not a multiple of 4.
+std::size_t base64_decoded_size(std::string_view text);
+/*
+ * Decodes base64 text into base64_decoded_size(text) bytes, false on
+ * characters outside the alphabet. Text split at multiples of 4 characters
+ * decodes independently; only the last part may end in '=' padding.
+ */
+bool decode_base64(std::string_view text, char *out);
+
+/*
+ * Streams the JSON through a SAX reader straight into `document`. With a
+ * writable byte after the text (`spare_byte`) or trailing whitespace the text
+ * is parsed in situ, otherwise it is read in place without being modified.
+ * Node transitions and material kinds are resolved as their objects end.
+ */
+bool parse_gltf_json(char *json, std::size_t length, bool spare_byte, GltfDocument &document);
+
 #endif //RAYTRACING_GLTF_HPP
@@ -0,0 +1,33 @@
+#ifndef RAYTRACING_HDR_IMAGE_HPP
+#define RAYTRACING_HDR_IMAGE_HPP
+
+#include "Color.hpp"
+
+#include <fstream>
+#include <vector>
+
+/*
+ * Linear floating point image with one or three interleaved channels, rows
+ * stored top to bottom. Written either as float32 PFM or as an uncompressed
+ * scanline OpenEXR with half float channels.
+ */
+struct HdrImage {
+	HdrImage() = default;
+	HdrImage(int height, int width, int channels, std::vector<float> data);
+	HdrImage(int height, int width, const std::vector<Color> &pixels);
+
+	// Single channel images are returned as grey.
+	Color get_pixel(int pixel) const;
+	std::vector<Color> pixels() const;
+
+	void save_pfm(std::ofstream &out) const;
+	void save_exr(std::ofstream &out) const;
+	// Reads either format, telling them apart by their magic.
+	bool load(std::ifstream &in);
+
+	int m_width = 0, m_height = 0;
+	int m_channels = 3;
+	std::vector<float> data;
+};
+
+#endif //RAYTRACING_HDR_IMAGE_HPP
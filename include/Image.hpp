@@ -3,13 +3,13 @@
 
 #include "Color.hpp"
 
-#include <fstream>
+#include <ostream>
 #include <vector>
 
 struct Image {
 	Image(int height, int width);
 	void set_pixel(int i, int j, Color color);
-	void save(std::ofstream &out);
+	void save(std::ostream &out) const;
 
 	int m_width, m_height;
 	std::vector<uint8_t> raw;
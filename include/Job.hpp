@@ -0,0 +1,75 @@
+#ifndef RAYTRACING_JOB_HPP
+#define RAYTRACING_JOB_HPP
+
+#include "Aov.hpp"
+#include "Image.hpp"
+#include "Sampler.hpp"
+#include "Scene.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+struct RenderOptions {
+	std::string checkpoint;
+	std::string resume;
+	std::string preview;
+	std::string hdr;
+	float exposure = 0.f;
+	int pass_samples = 16;
+	SamplerType sampler_type = SamplerType::SOBOL;
+	bool denoise = false;
+	std::vector<std::pair<Aov, std::string>> aovs;
+	// "all" or a file of camera poses, see load_camera_poses.
+	std::string cameras;
+	// Animation frames, sampled at frame / fps seconds.
+	int frames = 0;
+	float fps = 24.f;
+	// Distributed rendering, see Distributed.hpp.
+	int workers = 0;
+	int tile_size = 64;
+	float tile_timeout = 0.f;
+	std::string worker_command;
+};
+
+// One render request: "scene width height samples output [options]".
+struct RenderJob {
+	std::string scene;
+	int width = 0;
+	int height = 0;
+	int samples = 0;
+	std::string output;
+	RenderOptions options;
+	// The job as given, handed on to worker processes.
+	std::vector<std::string> args;
+};
+
+extern const char *job_usage;
+
+bool parse_options(int argc, const char *argv[], int first, RenderOptions &options);
+// argv starts with the scene path, not with the program name.
+bool parse_job(int argc, const char *argv[], RenderJob &job);
+// Applies the job's camera and sampling settings to the scene.
+void setup_scene(Scene &scene, const RenderJob &job);
+uint32_t job_aov_mask(const RenderJob &job);
+/*
+ * Renders the job with an already loaded scene, writing the checkpoint,
+ * preview, HDR and AOV files it asks for. The tonemapped image is returned
+ * rather than saved, so the caller decides where it goes.
+ */
+bool run_job(Scene &scene, const RenderJob &job, Image &image);
+/*
+ * One pose per line, "px py pz tx ty tz [ux uy uz] [fov_y degrees]": the
+ * camera position, the point it looks at, its up direction (+y by default)
+ * and its vertical field of view (fov_y by default). '#' starts a comment.
+ */
+bool load_camera_poses(const std::string &path, float fov_y, std::vector<Camera> &cameras);
+/*
+ * Renders the job once for every camera of options.cameras, or for every
+ * animation frame of options.frames, reusing the scene's BVH and light
+ * distribution, and writes each frame's outputs with its number in the file
+ * name.
+ */
+bool run_batch(Scene &scene, const RenderJob &job);
+
+#endif //RAYTRACING_JOB_HPP
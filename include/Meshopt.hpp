@@ -0,0 +1,30 @@
+#ifndef RAYTRACING_MESHOPT_HPP
+#define RAYTRACING_MESHOPT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Decoders for buffer views compressed with EXT_meshopt_compression.
+enum class MeshoptMode {
+	ATTRIBUTES,
+	TRIANGLES,
+	INDICES
+};
+
+enum class MeshoptFilter {
+	NONE,
+	OCTAHEDRAL,
+	QUATERNION,
+	EXPONENTIAL
+};
+
+/*
+ * Decodes `count` elements of `stride` bytes from `size` bytes of compressed
+ * `data` into `out`, applying the filter of ATTRIBUTES data afterwards.
+ * Returns false for malformed data or a stride the mode does not allow, in
+ * which case `out` is left partly written.
+ */
+bool meshopt_decode(MeshoptMode mode, MeshoptFilter filter, size_t count, size_t stride,
+		    const uint8_t *data, size_t size, uint8_t *out);
+
+#endif //RAYTRACING_MESHOPT_HPP
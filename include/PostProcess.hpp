@@ -0,0 +1,23 @@
+#ifndef RAYTRACING_POST_PROCESS_HPP
+#define RAYTRACING_POST_PROCESS_HPP
+
+#include "Color.hpp"
+#include "Framebuffer.hpp"
+#include "Image.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Exposure, ACES tonemap, gamma and 8-bit quantization over a whole buffer of
+ * linear channel values. Runs apart from rendering, so a framebuffer or a
+ * saved HDR image can be re-tonemapped without tracing a single ray.
+ */
+void tonemap(const float *channels, uint8_t *out, size_t count, float exposure = 0.f);
+
+// Exposure is given in stops.
+Image tonemap(const std::vector<Color> &pixels, int height, int width, float exposure = 0.f);
+Image tonemap(const Framebuffer &framebuffer, float exposure = 0.f);
+
+#endif //RAYTRACING_POST_PROCESS_HPP
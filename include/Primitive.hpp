@@ -36,6 +36,12 @@ struct Intersection {
 
 struct Primitive {
 	std::optional<Intersection> intersect(const Ray &ray, bool debug=false) const;
+	/*
+	 * Where a ray enters and leaves a box or ellipsoid, from one local-space
+	 * intersection: fills the crossings ahead of the origin, nearest first,
+	 * and returns how many there are.
+	 */
+	int intersect_crossings(const Ray &ray, Intersection crossings[2]) const;
 
 	static std::optional<IntersectionSmall> intersect_ignore_transformation_box_small(const glm::vec3 &diagonal, const Ray &ray, bool debug=false);
 private:
@@ -46,6 +52,7 @@ private:
 public:
     
     	GltfMaterial material;
+	int material_id = -1;
     	FigureType type;
 	glm::vec3 primitive_specific[3];
 	glm::vec3 position = {0, 0, 0};
@@ -7,83 +7,113 @@
 #include <Ray.hpp>
 #include <utils.hpp>
 
+#include <glm/vec2.hpp>
+
 #include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <memory>
-#include <random>
 
+/*
+ * Counter-based generator: every value is Philox4x32-10 of
+ * (dimension block | pixel, sample), so streams are reproducible regardless
+ * of thread count or tile order and blocks can be generated independently.
+ */
 struct Random {
-	Random(int seed);
+	Random(uint32_t pixel, uint32_t sample);
 
 	float uniform(float l = 0.f, float r = 1.f);
 	float normal(float mu = 0.f, float sigma = 1.f);
+	void uniform_batch(float *out, int count);
 
-	std::minstd_rand rnd;
-	std::uniform_real_distribution<float> uniform_;
-	std::normal_distribution<float> normal_;
-};
+	static void philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
 
-enum class DistributionType {
-    COSINE,
-    BOX,
-    ELLIPSOID,
-    TRIANGLE,
-    MIXED,
-    MIXED_ON_PRIMITIVES,
-    DISTRIBUTIONS_NUMBER
+	uint32_t key[2];
+	uint32_t dimension = 0;
+	uint32_t block[4];
 };
 
-struct Distribution {
-    	Distribution() = default;
+struct Sampler;
 
-	explicit Distribution(DistributionType type);
+// Triangles subtending less (tiny or distant) or more (nearly a hemisphere) fall back to area sampling.
+static const float min_spherical_sample_area = 3e-4f;
+static const float max_spherical_sample_area = 6.22f;
 
-	void init_box(const Primitive* box);
+struct DirectionSample {
+	glm::vec3 w;
+	float pdf;
+	// Emitter the direction was aimed at and an upper bound on the distance to the first hit.
+	const Primitive *emitter = nullptr;
+	float emitter_distance = INF;
+};
 
-	void init_ellipsoid(const Primitive* ellipsoid);
+/*
+ * Flat record of one emissive primitive. Triangles keep their world-space
+ * vertices and unit normal so sampling does not touch the Primitive.
+ */
+struct Emitter {
+	static Emitter make(const Primitive *primitive);
 
-	void init_triangle(const Primitive* ellipsoid);
+	DirectionSample sample_box(Sampler &sampler, glm::vec3 x) const;
 
-	void init_mixed(std::vector<Distribution> &&distributions);
+	DirectionSample sample_ellipsoid(Sampler &sampler, glm::vec3 x) const;
 
-	void init_mixed_on_primitives(const std::vector<Distribution> &distributions);
+	float triangle_solid_angle(glm::vec3 x) const;
 
-	glm::vec3 sample_cosine(Random &rnd_, glm::vec3 n_x) const;
+	glm::vec3 sample_spherical_triangle(glm::vec2 u, glm::vec3 x) const;
 
-	glm::vec3 sample_box(Random &rnd_, glm::vec3 x) const;
+	DirectionSample sample_triangle(Sampler &sampler, glm::vec3 x) const;
 
-	glm::vec3 sample_ellipsoid(Random &rnd_, glm::vec3 x) const;
+	// Direction towards the emitter with the pdf of this emitter alone.
+	DirectionSample sample(Sampler &sampler, glm::vec3 x) const;
 
-	glm::vec3 sample_triangle(Random &rnd_, glm::vec3 x) const;
+	float pdf1_box(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const;
 
-	glm::vec3 sample_mixed(Random &rnd_, glm::vec3 x, glm::vec3 n_x) const;
+	float pdf1_ellipsoid(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const;
 
-	glm::vec3 sample_mixed_on_primitives(Random &rnd_, glm::vec3 x, glm::vec3 n_x) const;
+	float pdf1_triangle(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const;
 
-    	glm::vec3 sample(Random &rnd_, glm::vec3 x, glm::vec3 n_x) const;
+	// Solid angle pdf of a box or ellipsoid along w, summed over the ray's crossings of its surface.
+	float pdf_crossings(glm::vec3 x, glm::vec3 w) const;
 
-	float pdf1_box(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const;
+	float pdf(glm::vec3 x, glm::vec3 w) const;
 
-	float pdf1_ellipsoid(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const;
+	FigureType type;
+	const Primitive *primitive;
+	float distrib_specific;
+	float area;
+	float selection_pdf;
+	glm::vec3 vertices[3];
+	glm::vec3 normal;
+};
 
-	float pdf1_triangle(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const;
+// Emitter BVHs up to this depth are walked with a stack of fixed size.
+static const int max_bvh_depth = 64;
 
-	float pdf_cosine(glm::vec3 n_x, glm::vec3 w) const;
+/*
+ * Mixture of cosine-weighted hemisphere sampling and emitter sampling,
+ * compiled once at Scene::init into flat arrays: emitter records in
+ * emitter BVH order and the cumulative table used to pick one of them.
+ */
+struct Distribution {
+    	Distribution() = default;
 
-    	float pdf1_primitive(glm::vec3 x, glm::vec3 w, glm::vec3 n_y) const;
+	explicit Distribution(const std::vector<const Primitive*> &emitters);
 
-	float pdf_mixed(glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const;
+	static DirectionSample sample_cosine(Sampler &sampler, glm::vec3 n_x);
 
-	float pdf_sum_bvh(uint32_t pos, glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const;
+	static float pdf_cosine(glm::vec3 n_x, glm::vec3 w);
 
-	float pdf_mixed_on_primitives(glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const;
+	// Sampled direction together with the pdf of the whole distribution along it.
+    	DirectionSample sample(Sampler &sampler, glm::vec3 x, glm::vec3 n_x) const;
+
+	float pdf_emitters(glm::vec3 x, glm::vec3 w, int skip = -1) const;
 
 	float pdf(glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const;
 
-	DistributionType type_;
-	const Primitive *primitive_;
-	std::vector<Distribution> distributions_;
-	float distrib_specific;
+	float cosine_weight = 1.f;
+	std::vector<Emitter> emitters_;
+	std::vector<float> cdf_;
 	BVH bvh_;
 };
 
@@ -0,0 +1,39 @@
+#ifndef RAYTRACING_SAMPLER_HPP
+#define RAYTRACING_SAMPLER_HPP
+
+#include "Random.hpp"
+
+#include <glm/vec2.hpp>
+
+#include <cstdint>
+
+enum class SamplerType {
+    INDEPENDENT,
+    STRATIFIED,
+    SOBOL,
+    SAMPLERS_NUMBER
+};
+
+/*
+ * Per-dimension sample streams for one (pixel, sample) pair. Every get1d()
+ * or get2d() call consumes one dimension; each dimension is decorrelated
+ * from the others by its own scramble seed, so paths of any length work.
+ */
+struct Sampler {
+	Sampler(SamplerType type, uint32_t samples_per_pixel);
+
+	void start_sample(uint32_t pixel, uint32_t sample);
+
+	float get1d();
+
+	glm::vec2 get2d();
+
+	SamplerType type_;
+	uint32_t samples_per_pixel_;
+	uint32_t pixel_ = 0;
+	uint32_t sample_ = 0;
+	uint32_t dimension_ = 0;
+	Random rnd_;
+};
+
+#endif //RAYTRACING_SAMPLER_HPP
@@ -1,35 +1,96 @@
 #ifndef RAYTRACING_SEMINAR_PRACTICE_SCENE_HPP
 #define RAYTRACING_SEMINAR_PRACTICE_SCENE_HPP
 
+#include "Arena.hpp"
 #include "BVH.hpp"
 #include "Camera.hpp"
 #include "Color.hpp"
 #include "Primitive.hpp"
 #include "Gltf.hpp"
 #include "Random.hpp"
+#include "Sampler.hpp"
 
 #include <memory>
 #include <vector>
 
+// Triangles of a moving node in its local space, re-transformed every frame.
+struct DynamicMesh {
+	std::size_t node;
+	std::size_t first_primitive;
+	std::vector<glm::vec3> vertices;
+};
+
+// An analytic shape of a moving node, re-posed every frame.
+struct DynamicShape {
+	std::size_t node;
+	// Index into planes for unbounded planes, into primitives otherwise.
+	std::size_t primitive;
+	bool unbounded;
+};
+
+// The local and world transforms a moving node was loaded with.
+struct LoadedPose {
+	std::size_t node;
+	glm::vec3 translation;
+	glm::quat rotation;
+	glm::vec3 scale;
+	Transform transition;
+	Transform total_transition;
+};
+
 struct Scene {
 	void init();
+	/*
+	 * Poses every animated node at `time` seconds and moves what hangs below
+	 * it: triangles, analytic shapes, cameras and the BVH bounds above the
+	 * moved primitives.
+	 * The BVH is only rebuilt once refitting has made its SAH cost exceed
+	 * bvh_rebuild_ratio times the cost it was built with.
+	 */
+	void set_time(float time);
+	// Puts every animated node back where it was loaded, which no time of the animation need match.
+	void reset_time();
+	float animation_duration() const;
 
+	// Decoded buffers and whatever else lives exactly as long as the scene.
+	Arena arena;
 	std::vector<GltfBuffer> buffers;
 	std::vector<GltfBufferView> bufferViews;
 	std::vector<GltfNode> nodes;
 	std::vector<GltfMesh> meshes;
 	std::vector<GltfAccessor> accessors;
 	std::vector<GltfMaterial> materials;
+	std::vector<GltfAnimationChannel> animation_channels;
 
 	Camera camera;
+	// Every camera node of the file; `camera` starts as the last of them.
+	std::vector<Camera> cameras;
+	std::vector<std::size_t> camera_nodes;
 	Color bg_color = black;
 	BVH bvh;
 	std::vector<Primitive> primitives;
 	std::vector<Primitive> planes;
+	// World-space (normal, offset) of every unbounded plane, so rays can find the nearest one cheaply.
+	std::vector<glm::vec4> plane_equations;
+	// Whether an unbounded plane is still clipped on some axis, so its equation alone does not prove a hit.
+	std::vector<char> plane_clipped;
 	int ray_depth = 1;
 	int samples;
+	SamplerType sampler_type = SamplerType::SOBOL;
 	Color ambient;
 	Distribution distribution;
+
+	std::vector<DynamicMesh> dynamic_meshes;
+	std::vector<DynamicShape> dynamic_shapes;
+	std::vector<LoadedPose> loaded_poses;
+	// BVH leaf of every primitive, for refitting.
+	std::vector<int> primitive_leaf;
+	float bvh_built_cost = 0.f;
+	float bvh_rebuild_ratio = 1.5f;
+
+	// Time load_scene spent parsing the JSON, and in total with the BVH build.
+	float parse_ms = 0.f;
+	float load_ms = 0.f;
 };
 
 Scene load_scene(std::string_view gltfFilename);
@@ -0,0 +1,51 @@
+#ifndef RAYTRACING_SERVER_HPP
+#define RAYTRACING_SERVER_HPP
+
+#include "Scene.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Loaded scenes, BVH and light distribution included, keyed by path. A scene
+ * is reloaded when its file changes, and the least recently used one is
+ * dropped once more than `capacity` are resident. Scenes live behind
+ * unique_ptr because their BVH and distribution point into them.
+ */
+struct SceneCache {
+	explicit SceneCache(size_t capacity);
+
+	// nullptr if the file cannot be found.
+	Scene *get(const std::string &path);
+
+	struct Entry {
+		std::string path;
+		std::filesystem::file_time_type modified;
+		std::unique_ptr<Scene> scene;
+	};
+
+	size_t capacity;
+	// Most recently used first.
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+struct ServerOptions {
+	// Reads jobs from stdin when empty.
+	std::string socket;
+	size_t cache_size = 4;
+};
+
+/*
+ * Reads one job per line, in the command line syntax without the program
+ * name, and answers each with "ok <milliseconds>" or "error <reason>". An
+ * output of "-" sends the image back as "ok <milliseconds> <bytes>" followed
+ * by the PPM itself. A "quit" line stops the server.
+ */
+int serve(const ServerOptions &options);
+
+#endif //RAYTRACING_SERVER_HPP
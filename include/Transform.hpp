@@ -21,6 +21,9 @@ public:
 
     glm::vec3 transform(const glm::vec3 &p) const;
 
+    // Same arithmetic as transform(), vectorized across `count` points.
+    void transform_points(const glm::vec3 *points, std::size_t count, glm::vec3 *result) const;
+
     float matrix_[4][4];
 };
 
@@ -4,6 +4,8 @@
 #include "glm/vec3.hpp"
 #include <glm/gtc/quaternion.hpp>
 
+#include <cmath>
+
 static const float PI = (float)acos(-1.0);
 
 inline glm::vec3
@@ -13,4 +15,15 @@ rotate(glm::vec3 v, glm::quat q)
 	return {res.x, res.y, res.z};
 }
 
+// Branchless frame around a unit vector (Duff et al., "Building an Orthonormal Basis, Revisited").
+inline void
+orthonormal_basis(glm::vec3 n, glm::vec3 &t, glm::vec3 &b)
+{
+	float sign = std::copysign(1.f, n.z);
+	float a = -1.f / (sign + n.z);
+	float c = n.x * n.y * a;
+	t = {1.f + sign * n.x * n.x * a, sign * c, -sign * n.x};
+	b = {c, sign + n.y * n.y * a, -n.y};
+}
+
 #endif //RAYTRACING_GEOMETRY_UTILS_HPP
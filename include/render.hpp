@@ -1,9 +1,14 @@
 #ifndef RAYTRACING_SEMINAR_PRACTICE_RENDER_HPP
 #define RAYTRACING_SEMINAR_PRACTICE_RENDER_HPP
 
+#include "Framebuffer.hpp"
 #include "Image.hpp"
 #include "Scene.hpp"
 
+// Adds `samples` more samples to every pixel of the framebuffer.
+void render(const Scene &scene, Framebuffer &framebuffer, int samples);
+// Same, for the pixels of one tile only. Samples are seeded by pixel, so tiles may be rendered anywhere.
+void render(const Scene &scene, Framebuffer &framebuffer, int samples, const Tile &tile);
 Image render(Scene &scene);
 
 #endif //RAYTRACING_SEMINAR_PRACTICE_RENDER_HPP
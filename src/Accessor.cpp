@@ -0,0 +1,194 @@
+#include <Accessor.hpp>
+
+#include <utils.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+int
+accessor_components(const std::string &type)
+{
+	static const std::pair<const char*, int> types[] = {
+		{"SCALAR", 1}, {"VEC2", 2}, {"VEC3", 3}, {"VEC4", 4}, {"MAT2", 4}, {"MAT3", 9}, {"MAT4", 16},
+	};
+	for (const auto &known : types)
+		if (type == known.first)
+			return known.second;
+	return 0;
+}
+
+size_t
+component_size(size_t component_type)
+{
+	switch (component_type) {
+		case (5120):
+		case (5121):
+			return 1;
+		case (5122):
+		case (5123):
+			return 2;
+		case (5125):
+		case (5126):
+			return 4;
+		default:
+			return 0;
+	}
+}
+
+bool
+accessor_data(const GltfAccessor &accessor, const std::vector<GltfBufferView> &buffer_views,
+	      const std::vector<GltfBuffer> &buffers, AccessorData &result)
+{
+	if (accessor.buffer_view >= buffer_views.size() || buffer_views[accessor.buffer_view].buffer >= buffers.size())
+		return false;
+	const auto &buffer_view = buffer_views[accessor.buffer_view];
+	const auto &buffer = buffers[buffer_view.buffer];
+	const int components = accessor_components(accessor.type);
+	const size_t element_size = components * component_size(accessor.component_type);
+	if (element_size == 0)
+		return false;
+	// Checked by subtraction and division, as offsets and counts come straight from the file and may be huge.
+	const size_t size = buffer.size();
+	if (buffer_view.byte_offset > size || accessor.byte_offset > size - buffer_view.byte_offset)
+		return false;
+	const size_t offset = buffer_view.byte_offset + accessor.byte_offset;
+	const size_t stride = (buffer_view.byte_stride == 0) ? element_size : buffer_view.byte_stride;
+	if (accessor.count > 0 &&
+	    (element_size > size - offset || accessor.count - 1 > (size - offset - element_size) / stride))
+		return false;
+	result.data = buffer.data() + offset;
+	result.count = accessor.count;
+	result.stride = stride;
+	result.component_type = accessor.component_type;
+	result.components = components;
+	result.normalized = accessor.normalized;
+	return true;
+}
+
+bool
+packed_floats(const AccessorData &accessor)
+{
+	return accessor.component_type == 5126 && accessor.stride == accessor.components * sizeof(float) &&
+	       (uintptr_t)accessor.data % alignof(float) == 0;
+}
+
+bool
+packed_indices(const AccessorData &accessor)
+{
+	return accessor.component_type == 5125 && accessor.stride == sizeof(uint32_t) &&
+	       (uintptr_t)accessor.data % alignof(uint32_t) == 0;
+}
+
+// Gathers N components per element from any stride and converts them in one vectorizable loop.
+template<typename T, int N>
+static void
+convert(const char *data, size_t stride, size_t count, float scale, float min, float *out)
+{
+	#pragma omp simd
+	for (size_t i = 0; i < count; i++) {
+		for (int k = 0; k < N; k++) {
+			T component;
+			memcpy(&component, data + i * stride + k * sizeof(T), sizeof(T));
+			out[i * N + k] = std::max((float)component * scale, min);
+		}
+	}
+}
+
+template<typename T>
+static void
+convert(const char *data, size_t stride, size_t count, int components, float scale, float min, float *out)
+{
+	switch (components) {
+		case (1):
+			convert<T, 1>(data, stride, count, scale, min, out);
+			break;
+		case (2):
+			convert<T, 2>(data, stride, count, scale, min, out);
+			break;
+		case (3):
+			convert<T, 3>(data, stride, count, scale, min, out);
+			break;
+		case (4):
+			convert<T, 4>(data, stride, count, scale, min, out);
+			break;
+		default:
+			for (size_t i = 0; i < count; i++)
+				convert<T, 1>(data + i * stride, sizeof(T), components, scale, min, out + i * components);
+			break;
+	}
+}
+
+void
+read_floats(const AccessorData &accessor, size_t first, size_t count, float *out)
+{
+	const char *data = accessor.data + first * accessor.stride;
+	const int components = accessor.components;
+	if (packed_floats(accessor)) {
+		memcpy(out, data, count * components * sizeof(float));
+		return;
+	}
+	const bool normalized = accessor.normalized;
+	const float unbounded = -std::numeric_limits<float>::infinity();
+	switch (accessor.component_type) {
+		case (5120):
+			convert<int8_t>(data, accessor.stride, count, components, normalized ? 1.f / 127 : 1.f,
+					normalized ? -1.f : unbounded, out);
+			break;
+		case (5121):
+			convert<uint8_t>(data, accessor.stride, count, components, normalized ? 1.f / 255 : 1.f,
+					 unbounded, out);
+			break;
+		case (5122):
+			convert<int16_t>(data, accessor.stride, count, components, normalized ? 1.f / 32767 : 1.f,
+					 normalized ? -1.f : unbounded, out);
+			break;
+		case (5123):
+			convert<uint16_t>(data, accessor.stride, count, components, normalized ? 1.f / 65535 : 1.f,
+					  unbounded, out);
+			break;
+		case (5125):
+			convert<uint32_t>(data, accessor.stride, count, components, 1.f, unbounded, out);
+			break;
+		case (5126):
+			convert<float>(data, accessor.stride, count, components, 1.f, unbounded, out);
+			break;
+		default:
+			unreachable();
+	}
+}
+
+template<typename T>
+static void
+widen(const char *data, size_t stride, size_t count, uint32_t *out)
+{
+	#pragma omp simd
+	for (size_t i = 0; i < count; i++) {
+		T index;
+		memcpy(&index, data + i * stride, sizeof(T));
+		out[i] = index;
+	}
+}
+
+void
+read_indices(const AccessorData &accessor, size_t first, size_t count, uint32_t *out)
+{
+	const char *data = accessor.data + first * accessor.stride;
+	if (packed_indices(accessor)) {
+		memcpy(out, data, count * sizeof(uint32_t));
+		return;
+	}
+	switch (accessor.component_type) {
+		case (5121):
+			widen<uint8_t>(data, accessor.stride, count, out);
+			break;
+		case (5123):
+			widen<uint16_t>(data, accessor.stride, count, out);
+			break;
+		case (5125):
+			widen<uint32_t>(data, accessor.stride, count, out);
+			break;
+		default:
+			unreachable();
+	}
+}
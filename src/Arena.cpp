@@ -0,0 +1,90 @@
+#include <Arena.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+#include <utility>
+
+#include <sys/mman.h>
+
+static const size_t min_chunk_size = 1 << 16;
+static const size_t huge_page_size = 1 << 21;
+
+Arena::Arena(Arena &&other) noexcept
+{
+	*this = std::move(other);
+}
+
+Arena &
+Arena::operator=(Arena &&other) noexcept
+{
+	std::swap(chunks, other.chunks);
+	std::swap(used, other.used);
+	return *this;
+}
+
+Arena::~Arena()
+{
+	for (const auto &chunk : chunks)
+		munmap(chunk.data, chunk.size);
+}
+
+void
+Arena::add_chunk(size_t size)
+{
+	// Chunks double so that many small allocations still map few of them.
+	size = std::max({size, min_chunk_size, chunks.empty() ? 0 : 2 * chunks.back().size});
+	if (size >= huge_page_size)
+		size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+	void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+	if (size >= huge_page_size)
+		madvise(data, size, MADV_HUGEPAGE);
+#endif
+	chunks.push_back({(char*)data, size});
+	used = 0;
+}
+
+void *
+Arena::allocate(size_t size, size_t alignment)
+{
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+	size_t offset = (used + alignment - 1) & ~(alignment - 1);
+	if (chunks.empty() || offset + size > chunks.back().size) {
+		add_chunk(size + alignment);
+		offset = 0;
+	}
+	used = offset + size;
+	return chunks.back().data + offset;
+}
+
+void
+Arena::reserve(size_t size)
+{
+	if (size > 0 && (chunks.empty() || used + size > chunks.back().size))
+		add_chunk(size);
+}
+
+void
+Arena::rewind(Marker marker)
+{
+	assert(marker.chunks <= chunks.size());
+	// Chunks double, so the last one is the largest; it stays for the next scope to start in.
+	if (marker.chunks == 0 && !chunks.empty()) {
+		std::swap(chunks.front(), chunks.back());
+		marker = {1, 0};
+	}
+	for (size_t i = marker.chunks; i < chunks.size(); i++)
+		munmap(chunks[i].data, chunks[i].size);
+	chunks.resize(marker.chunks);
+	used = marker.used;
+}
+
+Arena &
+scratch_arena()
+{
+	thread_local Arena arena;
+	return arena;
+}
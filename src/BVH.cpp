@@ -1,6 +1,8 @@
 #include <BVH.hpp>
+#include <Arena.hpp>
 #include <geometry_utils.hpp>
 #include <algorithm>
+#include <functional>
 #include <iostream>
 
 void AABB::extend(glm::vec3 p) {
@@ -28,8 +30,23 @@ enum class Axis {
 AABB build_aabb(const Primitive* primitive) {
 	AABB aabb_ignore_transformation;
 	switch(primitive->type) {
-		case (FigureType::PLANE):
-			unreachable();
+		case (FigureType::PLANE): {
+			// The clipped plane reaches along an axis no further than its extent, nor than
+			// the plane equation allows given the extents of the other two axes.
+			const auto &normal = primitive->primitive_specific[0];
+			const auto &extent = primitive->primitive_specific[1];
+			glm::vec3 bound;
+			for (int i = 0; i < 3; i++) {
+				float spread = 0.f;
+				for (int j = 0; j < 3; j++)
+					if (j != i)
+						spread += std::abs(normal[j]) * extent[j];
+				bound[i] = (std::abs(normal[i]) > 0.f) ? std::min(extent[i], spread / std::abs(normal[i])) : extent[i];
+			}
+			aabb_ignore_transformation.extend(-bound);
+			aabb_ignore_transformation.extend(bound);
+			break;
+		}
 		case (FigureType::BOX):
 		case (FigureType::ELLIPSOID):
 			aabb_ignore_transformation.extend(-primitive->primitive_specific[0]);
@@ -65,26 +82,30 @@ float aabb_surface_area(const AABB &aabb) {
 
 typedef std::tuple<float, Axis, int> Split;
 
+// Sorts the items of a node by the position of their primitive along an axis.
+static void
+sort_items(BuildItem *items, int first, int count, int axis)
+{
+	std::sort(items + first, items + first + count,
+		  [axis](const BuildItem &a, const BuildItem &b)
+		  { return a.primitive->position[axis] < b.primitive->position[axis]; });
+}
+
 Split
-seek_for_best_split(std::vector<const Primitive*> &primitives,
-		 std::unordered_map<const Primitive*, AABB> &aabbs,
-		 int first, int count)
+seek_for_best_split(BuildItem *items, float *scores, int first, int count)
 {
 	Split result = {INF, (Axis)0, -1};
 	for (int i = 0; i < (int)Axis::AXIS_COUNT; i++) {
-		std::sort(primitives.begin() + first,
-			  primitives.begin() + first + count,
-			  [i](const Primitive* &a, const Primitive* &b)
-		{ return a->position[i] < b->position[i]; });
-		std::vector<float> scores(count + 1);
+		sort_items(items, first, count, i);
+		std::fill(scores, scores + count + 1, 0.f);
 		AABB aabb;
 		for(int j = 0; j < count; j++) {
-			aabb.extend(aabbs[primitives[first + j]]);
+			aabb.extend(items[first + j].aabb);
 			scores[j + 1] += aabb_surface_area(aabb) * (float)(j + 1);
 		}
 		aabb = AABB();
 		for(int j = count - 1; j >= 0; j--) {
-			aabb.extend(aabbs[primitives[first + j]]);
+			aabb.extend(items[first + j].aabb);
 			scores[j] += aabb_surface_area(aabb) * (float)(count - j);
 		}
 		for(int j = 1; j < count; j++)
@@ -94,45 +115,106 @@ seek_for_best_split(std::vector<const Primitive*> &primitives,
 }
 
 int
-BVH::build_node(std::unordered_map<const Primitive*, AABB> &aabbs,
-		int first, int count)
+BVH::build_node(BuildItem *items, float *scores, int first, int count)
 {
 	Node current;
 	current.first_primitive_id = first;
 	current.primitive_count = count;
 	for (int i = first; i < first + count; i++)
-		current.aabb.extend(aabbs[primitives[i]]);
+		current.aabb.extend(items[i].aabb);
 	int id = (int)nodes.size();
 	nodes.push_back(current);
 	if (count <= 1)
 		return id;
-	auto split = seek_for_best_split(primitives, aabbs, first, count);
+	auto split = seek_for_best_split(items, scores, first, count);
 	float current_score = aabb_surface_area(current.aabb) * (float)count;
 	if (std::get<0>(split) >= current_score)
 		return id;
-	auto split_axis = (int)std::get<1>(split);
-	std::sort(primitives.begin() + first,
-		  primitives.begin() + first + count,
-		  [i = split_axis](const Primitive* &a, const Primitive* &b)
-		  { return a->position[i] < b->position[i]; });
+	sort_items(items, first, count, (int)std::get<1>(split));
 	int left_count = std::get<2>(split);
-	nodes[id].left_child = build_node(aabbs, first, left_count);
-	nodes[id].right_child = build_node(aabbs, first + left_count, count - left_count);
+	nodes[id].left_child = build_node(items, scores, first, left_count);
+	nodes[id].right_child = build_node(items, scores, first + left_count, count - left_count);
 	return id;
 }
 
 BVH::BVH(const std::vector<const Primitive*> &primitives_) : primitives(primitives_)
 {
-	std::unordered_map<const Primitive*, AABB> aabbs;
-	for(auto &primitive : primitives)
-		aabbs[primitive] = build_aabb(primitive);
-	root = build_node(aabbs, 0, (int)primitives.size());
+	// The items and split scores live in scratch memory; nodes are at most 2n - 1.
+	ScratchScope scratch;
+	const int count = (int)primitives.size();
+	auto *items = scratch.allocate<BuildItem>(count);
+	auto *scores = scratch.allocate<float>(count + 1);
+	for (int i = 0; i < count; i++)
+		items[i] = {primitives[i], build_aabb(primitives[i])};
+	nodes.reserve(std::max(2 * count - 1, 1));
+	root = build_node(items, scores, 0, count);
+	for (int i = 0; i < count; i++)
+		primitives[i] = items[i].primitive;
+	parents.assign(nodes.size(), -1);
+	// Children are created after their parent, so every level is known before it is needed.
+	std::vector<int> levels(nodes.size(), 0);
+	for (int id = 0; id < (int)nodes.size(); id++) {
+		const auto &node = nodes[id];
+		depth = std::max(depth, levels[id]);
+		if (node.left_child != -1) {
+			parents[node.left_child] = id;
+			parents[node.right_child] = id;
+			levels[node.left_child] = levels[node.right_child] = levels[id] + 1;
+			sah_area += aabb_surface_area(node.aabb);
+		} else {
+			sah_area += aabb_surface_area(node.aabb) * (float)node.primitive_count;
+		}
+	}
+}
+
+void
+BVH::refit(const std::vector<int> &leaves)
+{
+	// Children are always created after their parent, so decreasing ids visit them first.
+	ScratchScope scratch;
+	auto *dirty = scratch.allocate<int>(nodes.size());
+	auto *marked = scratch.allocate<char>(nodes.size());
+	std::fill(marked, marked + nodes.size(), 0);
+	size_t dirty_count = 0;
+	for (int id : leaves) {
+		for (; id != -1 && !marked[id]; id = parents[id]) {
+			marked[id] = 1;
+			dirty[dirty_count++] = id;
+		}
+	}
+	std::sort(dirty, dirty + dirty_count, std::greater<int>());
+	for (size_t i = 0; i < dirty_count; i++) {
+		auto &node = nodes[dirty[i]];
+		AABB aabb;
+		float weight = 1.f;
+		if (node.left_child != -1) {
+			aabb.extend(nodes[node.left_child].aabb);
+			aabb.extend(nodes[node.right_child].aabb);
+		} else {
+			for (int i = 0; i < node.primitive_count; i++)
+				aabb.extend(build_aabb(primitives[node.first_primitive_id + i]));
+			weight = (float)node.primitive_count;
+		}
+		if (node.primitive_count > 0)
+			sah_area += (aabb_surface_area(aabb) - aabb_surface_area(node.aabb)) * weight;
+		node.aabb = aabb;
+	}
+}
+
+float
+BVH::sah_cost() const
+{
+	if (nodes.empty() || nodes[root].primitive_count == 0)
+		return 0.f;
+	return (float)(sah_area / std::max(aabb_surface_area(nodes[root].aabb), EPS9));
 }
 
 std::optional<Intersection>
-BVH::intersect(Ray ray, int current_id, float min_distance, bool debug) const
+BVH::intersect(Ray ray, int current_id, float min_distance, bool debug, TraversalStats *stats) const
 {
 	const auto &current = nodes[(current_id == -1) ? root : current_id];
+	if (stats != nullptr)
+		stats->node_visits++;
 	auto aabb_intersection = current.aabb.intersect(ray);
 	if (!aabb_intersection.has_value())
 		return std::nullopt;
@@ -143,13 +225,15 @@ BVH::intersect(Ray ray, int current_id, float min_distance, bool debug) const
 	if (current.left_child != -1 && current.right_child != -1) {
 		int children[2] = {current.left_child, current.right_child};
 		for (auto &child_id : children) {
-			auto intersection = intersect(ray, child_id, min_distance, debug);
+			auto intersection = intersect(ray, child_id, min_distance, debug, stats);
 			if (intersection.has_value() && intersection->distance < min_distance) {
 				min_distance = intersection->distance;
 				result = intersection;
 			}
 		}
 	} else {
+		if (stats != nullptr)
+			stats->primitive_tests += current.primitive_count;
 		for (int i = 0; i < current.primitive_count; i++) {
 			const auto &primitive = primitives[current.first_primitive_id + i];
 			auto intersection = primitive->intersect(ray);
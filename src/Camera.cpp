@@ -18,4 +18,16 @@ Camera::ray_throw(float x, float y) const
 			       right * ((2.f * (float)x) / (float)width - 1.f) * tan_fov_x + forward),
 		position
 	};
-}
\ No newline at end of file
+}
+
+Camera
+Camera::look_at(glm::vec3 position, glm::vec3 target, glm::vec3 up, float fov_y)
+{
+	Camera camera{};
+	camera.position = position;
+	camera.forward = glm::normalize(target - position);
+	camera.right = glm::normalize(glm::cross(camera.forward, up));
+	camera.up = glm::cross(camera.right, camera.forward);
+	camera.fov_y = fov_y;
+	return camera;
+}
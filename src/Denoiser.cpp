@@ -0,0 +1,147 @@
+#include <Denoiser.hpp>
+
+#include <utils.hpp>
+
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+static const float kernel[5] = {1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+static const float min_albedo = 1e-2f;
+
+// Structure of arrays, so the per-pixel filter loop vectorizes over a row.
+struct Planes {
+	explicit Planes(size_t size) : r(size), g(size), b(size) {}
+
+	std::vector<float> r, g, b;
+};
+
+static inline float
+compress(float x)
+{
+	return x / (1.f + x);
+}
+
+// Clamps every channel to the range of its 8 neighbours, removing isolated fireflies before filtering.
+static void
+clamp_outliers(const Planes &in, Planes &out, int height, int width)
+{
+	std::vector<float> Planes::*channels[3] = {&Planes::r, &Planes::g, &Planes::b};
+	for (auto channel : channels) {
+		const auto &src = in.*channel;
+		auto &dst = out.*channel;
+		#pragma omp parallel for schedule(static)
+		for (int i = 0; i < height; i++) {
+			#pragma omp simd
+			for (int j = 0; j < width; j++) {
+				float lo = INF, hi = -INF;
+				for (int dy = -1; dy <= 1; dy++) {
+					const int y = std::min(std::max(i + dy, 0), height - 1);
+					for (int dx = -1; dx <= 1; dx++) {
+						const int x = std::min(std::max(j + dx, 0), width - 1);
+						const float v = src[y * width + x];
+						const bool neighbour = (dx != 0 || dy != 0);
+						lo = neighbour ? std::min(lo, v) : lo;
+						hi = neighbour ? std::max(hi, v) : hi;
+					}
+				}
+				dst[i * width + j] = std::min(std::max(src[i * width + j], lo), hi);
+			}
+		}
+	}
+}
+
+std::vector<Color>
+denoise(const Framebuffer &framebuffer, const DenoiserSettings &settings)
+{
+	assert((framebuffer.aov_mask & denoiser_aovs) == denoiser_aovs);
+	const int width = framebuffer.m_width, height = framebuffer.m_height;
+	const size_t size = (size_t)width * height;
+
+	Planes current(size), next(size), albedo(size), normal(size);
+	std::vector<float> depth(size);
+	#pragma omp parallel for schedule(static)
+	for (int pixel = 0; pixel < (int)size; pixel++) {
+		auto color = framebuffer.get_pixel(pixel);
+		auto a = glm::max(framebuffer.get_aov(pixel, Aov::ALBEDO), Color(min_albedo));
+		auto n = framebuffer.get_aov(pixel, Aov::NORMAL);
+		albedo.r[pixel] = a.x;
+		albedo.g[pixel] = a.y;
+		albedo.b[pixel] = a.z;
+		current.r[pixel] = color.x / a.x;
+		current.g[pixel] = color.y / a.y;
+		current.b[pixel] = color.z / a.z;
+		normal.r[pixel] = n.x;
+		normal.g[pixel] = n.y;
+		normal.b[pixel] = n.z;
+		depth[pixel] = framebuffer.get_aov(pixel, Aov::DEPTH).x;
+	}
+
+	clamp_outliers(current, next, height, width);
+	std::swap(current, next);
+
+	for (int iteration = 0; iteration < settings.iterations; iteration++) {
+		const int step = 1 << iteration;
+		const float inv_sigma_color = 1.f / (settings.sigma_color * ldexpf(1.f, -iteration));
+		const float inv_sigma_albedo = 1.f / settings.sigma_albedo;
+		#pragma omp parallel for schedule(static)
+		for (int i = 0; i < height; i++) {
+			#pragma omp simd
+			for (int j = 0; j < width; j++) {
+				const int p = i * width + j;
+				const float cr = compress(current.r[p]), cg = compress(current.g[p]), cb = compress(current.b[p]);
+				float sum_r = 0.f, sum_g = 0.f, sum_b = 0.f, sum_w = 0.f;
+				for (int dy = -2; dy <= 2; dy++) {
+					const int y = i + dy * step;
+					const float inside_y = (0 <= y && y < height) ? 1.f : 0.f;
+					const int qy = std::min(std::max(y, 0), height - 1);
+					for (int dx = -2; dx <= 2; dx++) {
+						const int x = j + dx * step;
+						const float inside = (0 <= x && x < width) ? inside_y : 0.f;
+						const int q = qy * width + std::min(std::max(x, 0), width - 1);
+
+						const float dr = compress(current.r[q]) - cr;
+						const float dg = compress(current.g[q]) - cg;
+						const float db = compress(current.b[q]) - cb;
+						const float w_color = expf(-(dr * dr + dg * dg + db * db) * inv_sigma_color);
+
+						const float n_dot = normal.r[p] * normal.r[q] + normal.g[p] * normal.g[q] +
+								    normal.b[p] * normal.b[q];
+						const float w_normal = powf(std::max(0.f, n_dot), settings.normal_power);
+
+						const float dz = std::abs(depth[p] - depth[q]) /
+								 (settings.sigma_depth * (depth[p] + EPS4) * (float)step);
+						const float w_depth = expf(-dz);
+
+						const float ar = albedo.r[p] - albedo.r[q];
+						const float ag = albedo.g[p] - albedo.g[q];
+						const float ab = albedo.b[p] - albedo.b[q];
+						const float w_albedo = expf(-(ar * ar + ag * ag + ab * ab) * inv_sigma_albedo);
+
+						// The center tap always counts fully, so background pixels stay untouched.
+						const float center = (dx == 0 && dy == 0) ? 1.f : 0.f;
+						const float w = kernel[dx + 2] * kernel[dy + 2] * inside *
+								std::max(center, w_color * w_normal * w_depth * w_albedo);
+						sum_r += w * current.r[q];
+						sum_g += w * current.g[q];
+						sum_b += w * current.b[q];
+						sum_w += w;
+					}
+				}
+				next.r[p] = sum_r / sum_w;
+				next.g[p] = sum_g / sum_w;
+				next.b[p] = sum_b / sum_w;
+			}
+		}
+		std::swap(current, next);
+	}
+
+	std::vector<Color> result(size);
+	#pragma omp parallel for schedule(static)
+	for (int pixel = 0; pixel < (int)size; pixel++)
+		result[pixel] = Color(current.r[pixel] * albedo.r[pixel],
+				      current.g[pixel] * albedo.g[pixel],
+				      current.b[pixel] * albedo.b[pixel]);
+	return result;
+}
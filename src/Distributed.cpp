@@ -0,0 +1,320 @@
+#include <Distributed.hpp>
+
+#include <render.hpp>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static const int poll_interval_ms = 100;
+// A tile is duplicated once it runs this many times longer than an average one.
+static const double straggler_factor = 2.0;
+static const int max_copies = 2;
+
+struct Worker {
+	pid_t pid = -1;
+	int to = -1;
+	int from = -1;
+	// -1 while idle.
+	int tile = -1;
+	Clock::time_point started;
+	std::string received;
+};
+
+static std::string
+shell_quote(const std::string &word)
+{
+	std::string quoted = "'";
+	for (char c : word)
+		quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+	return quoted + "'";
+}
+
+static bool
+spawn(Worker &worker, const RenderJob &job)
+{
+	// Everything is allocated before fork, the child only calls async-signal-safe functions.
+	std::vector<std::string> words = {"raytracing", "--worker"};
+	words.insert(words.end(), job.args.begin(), job.args.end());
+	std::vector<char*> argv;
+	for (auto &word : words)
+		argv.push_back(word.data());
+	argv.push_back(nullptr);
+	std::string command = "exec " + job.options.worker_command;
+	for (size_t i = 1; i < words.size(); i++)
+		command += " " + shell_quote(words[i]);
+
+	int to[2], from[2];
+	if (pipe2(to, O_CLOEXEC) != 0)
+		return false;
+	if (pipe2(from, O_CLOEXEC) != 0) {
+		close(to[0]);
+		close(to[1]);
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Its own process group, so stopping a worker also stops whatever a worker command started.
+		setpgid(0, 0);
+		dup2(to[0], STDIN_FILENO);
+		dup2(from[1], STDOUT_FILENO);
+		if (job.options.worker_command.empty())
+			execv("/proc/self/exe", argv.data());
+		else
+			execl("/bin/sh", "sh", "-c", command.c_str(), (char*)nullptr);
+		_exit(127);
+	}
+	close(to[0]);
+	close(from[1]);
+	if (pid < 0) {
+		close(to[1]);
+		close(from[0]);
+		return false;
+	}
+	worker = Worker();
+	worker.pid = pid;
+	worker.to = to[1];
+	worker.from = from[0];
+	return true;
+}
+
+static void
+stop(Worker &worker, bool force)
+{
+	if (worker.pid < 0)
+		return;
+	close(worker.to);
+	close(worker.from);
+	if (force)
+		kill(-worker.pid, SIGKILL);
+	waitpid(worker.pid, nullptr, 0);
+	worker.pid = -1;
+	worker.tile = -1;
+}
+
+static bool
+write_all(int fd, const std::string &data)
+{
+	for (size_t written = 0; written < data.size();) {
+		auto n = write(fd, data.data() + written, data.size() - written);
+		if (n <= 0)
+			return false;
+		written += (size_t)n;
+	}
+	return true;
+}
+
+bool
+render_distributed(const RenderJob &job, Framebuffer &framebuffer)
+{
+	const auto &options = job.options;
+	// Progressive passes always leave every pixel with the same count.
+	const uint32_t first = framebuffer.min_samples();
+	if ((int)first >= job.samples)
+		return true;
+	const int samples = job.samples - (int)first;
+
+	std::vector<Tile> tiles;
+	for (int y = 0; y < framebuffer.m_height; y += options.tile_size)
+		for (int x = 0; x < framebuffer.m_width; x += options.tile_size)
+			tiles.push_back({x, y, std::min(x + options.tile_size, framebuffer.m_width),
+					 std::min(y + options.tile_size, framebuffer.m_height)});
+	std::deque<int> pending;
+	for (int i = 0; i < (int)tiles.size(); i++)
+		pending.push_back(i);
+	std::vector<char> done(tiles.size(), 0);
+	std::vector<int> copies(tiles.size(), 0);
+	int remaining = (int)tiles.size();
+	double average_seconds = 0.;
+	int completed = 0;
+
+	signal(SIGPIPE, SIG_IGN);
+	std::vector<Worker> workers(std::min(options.workers, (int)tiles.size()));
+	int respawns = 2 * (int)workers.size();
+	for (auto &worker : workers) {
+		if (!spawn(worker, job)) {
+			perror("fork");
+			for (auto &started : workers)
+				stop(started, true);
+			return false;
+		}
+	}
+
+	auto fail = [&](Worker &worker) {
+		int tile = worker.tile;
+		stop(worker, true);
+		if (tile >= 0 && --copies[tile] == 0 && !done[tile])
+			pending.push_front(tile);
+		if (respawns > 0 && spawn(worker, job))
+			respawns--;
+	};
+
+	// Pending tiles first, then a copy of the oldest straggler.
+	auto next_tile = [&](const Worker &idle) {
+		while (!pending.empty() && done[pending.front()])
+			pending.pop_front();
+		if (!pending.empty()) {
+			int tile = pending.front();
+			pending.pop_front();
+			return tile;
+		}
+		if (completed == 0)
+			return -1;
+		const Worker *oldest = nullptr;
+		for (const auto &worker : workers)
+			if (&worker != &idle && worker.pid >= 0 && worker.tile >= 0 && !done[worker.tile] &&
+			    copies[worker.tile] < max_copies && (oldest == nullptr || worker.started < oldest->started))
+				oldest = &worker;
+		if (oldest == nullptr)
+			return -1;
+		std::chrono::duration<double> age = Clock::now() - oldest->started;
+		return (age.count() > straggler_factor * average_seconds) ? oldest->tile : -1;
+	};
+
+	auto receive = [&](Worker &worker) {
+		auto newline = worker.received.find('\n');
+		if (newline == std::string::npos)
+			return true;
+		int id;
+		size_t size;
+		if (sscanf(worker.received.c_str(), "done %d %zu", &id, &size) != 2 || id != worker.tile)
+			return false;
+		if (worker.received.size() < newline + 1 + size)
+			return true;
+		std::vector<char> data(worker.received.begin() + (long)newline + 1,
+				       worker.received.begin() + (long)(newline + 1 + size));
+		worker.received.erase(0, newline + 1 + size);
+		copies[id]--;
+		worker.tile = -1;
+		if (done[id])
+			return true;
+		if (!framebuffer.load_tile(data, tiles[id]))
+			return false;
+		done[id] = 1;
+		remaining--;
+		std::chrono::duration<double> elapsed = Clock::now() - worker.started;
+		average_seconds += (elapsed.count() - average_seconds) / ++completed;
+		return true;
+	};
+
+	while (remaining > 0) {
+		for (auto &worker : workers) {
+			if (worker.pid < 0 || worker.tile >= 0)
+				continue;
+			int tile = next_tile(worker);
+			if (tile < 0)
+				break;
+			const auto &t = tiles[tile];
+			// The worker continues from the tile's current sums, so resumed renders add samples in the same order.
+			auto state = framebuffer.save_tile(t);
+			char request[128];
+			snprintf(request, sizeof(request), "tile %d %d %d %d %d %d %zu\n",
+				 tile, t.x0, t.y0, t.x1, t.y1, samples, state.size());
+			worker.tile = tile;
+			worker.started = Clock::now();
+			copies[tile]++;
+			if (!write_all(worker.to, request + std::string(state.begin(), state.end())))
+				fail(worker);
+		}
+
+		std::vector<pollfd> fds;
+		std::vector<Worker*> polled;
+		for (auto &worker : workers) {
+			if (worker.pid >= 0 && worker.tile >= 0) {
+				fds.push_back({worker.from, POLLIN, 0});
+				polled.push_back(&worker);
+			}
+		}
+		if (fds.empty()) {
+			bool alive = std::any_of(workers.begin(), workers.end(),
+						 [](const Worker &worker) { return worker.pid >= 0; });
+			if (!alive) {
+				std::cerr << "all workers failed, " << remaining << " tiles left" << std::endl;
+				return false;
+			}
+			continue;
+		}
+		poll(fds.data(), fds.size(), poll_interval_ms);
+		for (size_t i = 0; i < fds.size(); i++) {
+			auto &worker = *polled[i];
+			if (fds[i].revents == 0)
+				continue;
+			char buffer[1 << 16];
+			auto n = read(worker.from, buffer, sizeof(buffer));
+			if (n <= 0) {
+				fail(worker);
+				continue;
+			}
+			worker.received.append(buffer, (size_t)n);
+			if (!receive(worker))
+				fail(worker);
+		}
+
+		if (options.tile_timeout > 0.f) {
+			for (auto &worker : workers) {
+				std::chrono::duration<double> age = Clock::now() - worker.started;
+				if (worker.pid >= 0 && worker.tile >= 0 && age.count() > options.tile_timeout)
+					fail(worker);
+			}
+		}
+	}
+
+	// Idle workers exit once their input closes; the rest are only rendering duplicates.
+	for (auto &worker : workers)
+		stop(worker, worker.tile >= 0);
+	return true;
+}
+
+int
+worker_main(int argc, const char *argv[])
+{
+	RenderJob job;
+	if (!parse_job(argc - 2, argv + 2, job)) {
+		std::cerr << "usage: " << argv[0] << " --worker " << job_usage << std::endl;
+		return 1;
+	}
+	auto scene = load_scene(job.scene);
+	setup_scene(scene, job);
+	Framebuffer framebuffer(job.height, job.width, job_aov_mask(job));
+
+	char *line = nullptr;
+	size_t line_capacity = 0;
+	while (getline(&line, &line_capacity, stdin) > 0) {
+		int id, samples;
+		size_t size;
+		Tile tile;
+		if (sscanf(line, "tile %d %d %d %d %d %d %zu", &id, &tile.x0, &tile.y0, &tile.x1, &tile.y1,
+			   &samples, &size) != 7 ||
+		    tile.x0 < 0 || tile.y0 < 0 || tile.x1 > job.width || tile.y1 > job.height ||
+		    tile.x0 >= tile.x1 || tile.y0 >= tile.y1) {
+			std::cerr << "bad request: " << line;
+			break;
+		}
+		// Sized like the tile's own data, so a wrong size is caught before anything is read.
+		auto state = framebuffer.save_tile(tile);
+		if (size != state.size() || fread(state.data(), 1, size, stdin) != size || !framebuffer.load_tile(state, tile)) {
+			std::cerr << "truncated tile " << id << std::endl;
+			break;
+		}
+		render(scene, framebuffer, samples, tile);
+		auto data = framebuffer.save_tile(tile);
+		printf("done %d %zu\n", id, data.size());
+		fwrite(data.data(), 1, data.size(), stdout);
+		fflush(stdout);
+	}
+	free(line);
+	return 0;
+}
@@ -0,0 +1,198 @@
+#include <Framebuffer.hpp>
+
+#include <utils.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+static const char checkpoint_magic[4] = {'R', 'T', 'C', 'P'};
+static const uint32_t checkpoint_version = 3;
+
+Framebuffer::Framebuffer(int height, int width, uint32_t aov_mask) :
+	m_width(width),
+	m_height(height),
+	accumulated(height * width, black),
+	sample_count(height * width, 0),
+	aov_mask(aov_mask)
+{
+	for (int aov = 0; aov < (int)Aov::AOVS_NUMBER; aov++)
+		if (has_aov((Aov)aov))
+			aovs[aov].assign((size_t)height * width * aov_channels((Aov)aov), 0.f);
+}
+
+void
+Framebuffer::add_sample(int pixel, Color color, const SampleAovs *sample_aovs)
+{
+	assert(0 <= pixel && pixel < m_height * m_width);
+	if (sample_aovs != nullptr) {
+		for (int aov = 0; aov < (int)Aov::AOVS_NUMBER; aov++) {
+			if (!has_aov((Aov)aov) || (aov_is_id((Aov)aov) && sample_count[pixel] != 0))
+				continue;
+			const int channels = aov_channels((Aov)aov);
+			auto value = sample_aovs->get((Aov)aov);
+			for (int c = 0; c < channels; c++)
+				aovs[aov][(size_t)pixel * channels + c] += value[c];
+		}
+	}
+	accumulated[pixel] += color;
+	sample_count[pixel]++;
+}
+
+bool
+Framebuffer::has_aov(Aov aov) const
+{
+	return (aov_mask & aov_bit(aov)) != 0;
+}
+
+Color
+Framebuffer::get_pixel(int pixel) const
+{
+	assert(0 <= pixel && pixel < m_height * m_width);
+	if (sample_count[pixel] == 0)
+		return black;
+	return accumulated[pixel] / (float)sample_count[pixel];
+}
+
+glm::vec3
+Framebuffer::get_aov(int pixel, Aov aov) const
+{
+	assert(has_aov(aov));
+	glm::vec3 value(0.f);
+	const int channels = aov_channels(aov);
+	for (int c = 0; c < channels; c++)
+		value[c] = aovs[(int)aov][(size_t)pixel * channels + c];
+	if (aov_is_id(aov))
+		return (sample_count[pixel] == 0) ? glm::vec3(-1.f) : value;
+	if (sample_count[pixel] == 0)
+		return value;
+	return value / (float)sample_count[pixel];
+}
+
+std::vector<Color>
+Framebuffer::resolve() const
+{
+	std::vector<Color> pixels(accumulated.size());
+	#pragma omp parallel for schedule(static)
+	for (int pixel = 0; pixel < (int)pixels.size(); pixel++)
+		pixels[pixel] = get_pixel(pixel);
+	return pixels;
+}
+
+std::vector<float>
+Framebuffer::resolve_aov(Aov aov) const
+{
+	const int channels = aov_channels(aov);
+	std::vector<float> values(sample_count.size() * channels);
+	#pragma omp parallel for schedule(static)
+	for (int pixel = 0; pixel < (int)sample_count.size(); pixel++) {
+		auto value = get_aov(pixel, aov);
+		for (int c = 0; c < channels; c++)
+			values[(size_t)pixel * channels + c] = value[c];
+	}
+	return values;
+}
+
+uint32_t
+Framebuffer::min_samples() const
+{
+	if (sample_count.empty())
+		return 0;
+	return *std::min_element(sample_count.begin(), sample_count.end());
+}
+
+void
+Framebuffer::save_checkpoint(std::ofstream &out) const
+{
+	int32_t size[2] = {m_width, m_height};
+	out.write(checkpoint_magic, sizeof(checkpoint_magic));
+	out.write((const char*)&checkpoint_version, sizeof(checkpoint_version));
+	out.write((const char*)size, sizeof(size));
+	out.write((const char*)&aov_mask, sizeof(aov_mask));
+	out.write((const char*)accumulated.data(), (std::streamsize)(accumulated.size() * sizeof(Color)));
+	out.write((const char*)sample_count.data(), (std::streamsize)(sample_count.size() * sizeof(uint32_t)));
+	for (const auto &values : aovs)
+		out.write((const char*)values.data(), (std::streamsize)(values.size() * sizeof(float)));
+}
+
+bool
+Framebuffer::load_checkpoint(std::ifstream &in)
+{
+	char magic[4];
+	uint32_t version;
+	int32_t size[2];
+	uint32_t mask;
+	in.read(magic, sizeof(magic));
+	in.read((char*)&version, sizeof(version));
+	in.read((char*)size, sizeof(size));
+	in.read((char*)&mask, sizeof(mask));
+	if (!in || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 || version != checkpoint_version)
+		return false;
+	// The AOV sums must cover the same samples as the radiance.
+	if (size[0] != m_width || size[1] != m_height || mask != aov_mask)
+		return false;
+	in.read((char*)accumulated.data(), (std::streamsize)(accumulated.size() * sizeof(Color)));
+	in.read((char*)sample_count.data(), (std::streamsize)(sample_count.size() * sizeof(uint32_t)));
+	for (auto &values : aovs)
+		in.read((char*)values.data(), (std::streamsize)(values.size() * sizeof(float)));
+	return (bool)in;
+}
+
+// Bytes one pixel takes in a saved tile.
+static size_t
+tile_pixel_size(const Framebuffer &framebuffer)
+{
+	size_t size = sizeof(Color) + sizeof(uint32_t);
+	for (int aov = 0; aov < (int)Aov::AOVS_NUMBER; aov++)
+		if (framebuffer.has_aov((Aov)aov))
+			size += aov_channels((Aov)aov) * sizeof(float);
+	return size;
+}
+
+std::vector<char>
+Framebuffer::save_tile(const Tile &tile) const
+{
+	std::vector<char> data((size_t)tile.area() * tile_pixel_size(*this));
+	char *out = data.data();
+	auto put = [&out](const void *value, size_t size) {
+		memcpy(out, value, size);
+		out += size;
+	};
+	for (int i = tile.y0; i < tile.y1; i++) {
+		for (int j = tile.x0; j < tile.x1; j++) {
+			const int pixel = i * m_width + j;
+			put(&accumulated[pixel], sizeof(Color));
+			put(&sample_count[pixel], sizeof(uint32_t));
+			for (int aov = 0; aov < (int)Aov::AOVS_NUMBER; aov++) {
+				const int channels = aov_channels((Aov)aov);
+				if (has_aov((Aov)aov))
+					put(aovs[aov].data() + (size_t)pixel * channels, channels * sizeof(float));
+			}
+		}
+	}
+	return data;
+}
+
+bool
+Framebuffer::load_tile(const std::vector<char> &data, const Tile &tile)
+{
+	if (data.size() != (size_t)tile.area() * tile_pixel_size(*this))
+		return false;
+	const char *in = data.data();
+	auto get = [&in](void *value, size_t size) {
+		memcpy(value, in, size);
+		in += size;
+	};
+	for (int i = tile.y0; i < tile.y1; i++) {
+		for (int j = tile.x0; j < tile.x1; j++) {
+			const int pixel = i * m_width + j;
+			get(&accumulated[pixel], sizeof(Color));
+			get(&sample_count[pixel], sizeof(uint32_t));
+			for (int aov = 0; aov < (int)Aov::AOVS_NUMBER; aov++) {
+				const int channels = aov_channels((Aov)aov);
+				if (has_aov((Aov)aov))
+					get(aovs[aov].data() + (size_t)pixel * channels, channels * sizeof(float));
+			}
+		}
+	}
+	return true;
+}
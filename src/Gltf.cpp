@@ -0,0 +1,563 @@
+#include <Gltf.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rapidjson/error/en.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+
+bool
+GltfBuffer::map(const std::string &path, bool writable)
+{
+    *this = GltfBuffer();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    const auto length = (std::size_t)st.st_size;
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+    void *pages = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pages == MAP_FAILED)
+        return false;
+    madvise(pages, length, MADV_WILLNEED);
+    mapping = std::shared_ptr<char>((char*)pages, [length](char *pages) { munmap(pages, length); });
+    m_data = mapping.get();
+    m_size = length;
+    return true;
+}
+
+void
+GltfBuffer::assign(char *data, std::size_t length)
+{
+    mapping.reset();
+    m_data = data;
+    m_size = length;
+}
+
+GltfBuffer
+GltfBuffer::slice(std::size_t offset, std::size_t length) const
+{
+    assert(offset <= m_size && length <= m_size - offset);
+    GltfBuffer result;
+    result.mapping = mapping;
+    result.m_data = m_data + offset;
+    result.m_size = length;
+    return result;
+}
+
+std::size_t
+base64_decoded_size(std::string_view text)
+{
+    if (text.size() % 4 != 0)
+        return SIZE_MAX;
+    std::size_t size = text.size() / 4 * 3;
+    if (!text.empty() && text.back() == '=')
+        size -= (text[text.size() - 2] == '=') ? 2 : 1;
+    return size;
+}
+
+// 6 bit value of a base64 character, 0x80 outside the alphabet. Branchless so that loops over it vectorize.
+static inline uint8_t
+base64_value(uint8_t c)
+{
+    uint8_t value = 0x80;
+    value = ((uint8_t)(c - 'A') < 26) ? (uint8_t)(c - 'A') : value;
+    value = ((uint8_t)(c - 'a') < 26) ? (uint8_t)(c - 'a' + 26) : value;
+    value = ((uint8_t)(c - '0') < 10) ? (uint8_t)(c - '0' + 52) : value;
+    value = (c == '+') ? (uint8_t)62 : value;
+    value = (c == '/') ? (uint8_t)63 : value;
+    return value;
+}
+
+bool
+decode_base64(std::string_view text, char *out)
+{
+    const std::size_t size = base64_decoded_size(text);
+    if (size == SIZE_MAX)
+        return false;
+    // Groups without padding go through the vectorized loops, a block at a time.
+    const std::size_t groups = size / 3;
+    const auto *in = (const uint8_t*)text.data();
+    auto *bytes = (uint8_t*)out;
+    static const std::size_t block = 256;
+    uint8_t values[4 * block];
+    uint8_t invalid = 0;
+    for (std::size_t first = 0; first < groups; first += block) {
+        const std::size_t count = std::min(block, groups - first);
+        const uint8_t *chars = in + 4 * first;
+        #pragma omp simd reduction(|:invalid)
+        for (std::size_t i = 0; i < 4 * count; i++) {
+            values[i] = base64_value(chars[i]);
+            invalid |= values[i];
+        }
+        // Packing works on 32 bit lanes, leaving each group's 3 bytes at the front of a little-endian word.
+        uint32_t words[block];
+        #pragma omp simd
+        for (std::size_t i = 0; i < count; i++) {
+            uint32_t word;
+            memcpy(&word, values + 4 * i, sizeof(word));
+            const uint32_t bits = (word & 0x3f) << 18 | (word >> 8 & 0x3f) << 12 | (word >> 16 & 0x3f) << 6 |
+                                  (word >> 24 & 0x3f);
+            words[i] = (bits >> 16 & 0xff) | (bits & 0xff00) | (bits & 0xff) << 16;
+        }
+        // Whole words overlap the next group's first byte, except at the end where another range may follow.
+        uint8_t *group = bytes + 3 * first;
+        const std::size_t whole = (first + count == groups) ? count - 1 : count;
+        for (std::size_t i = 0; i < whole; i++)
+            memcpy(group + 3 * i, &words[i], 4);
+        if (whole < count)
+            memcpy(group + 3 * whole, &words[whole], 3);
+    }
+    if (invalid & 0x80)
+        return false;
+
+    // A padded last group carries one or two bytes.
+    const std::size_t tail = size - 3 * groups;
+    if (tail > 0) {
+        const uint8_t *chars = in + 4 * groups;
+        const uint8_t a = base64_value(chars[0]), b = base64_value(chars[1]);
+        const uint8_t c = (tail == 2) ? base64_value(chars[2]) : 0;
+        if ((a | b | c) & 0x80)
+            return false;
+        bytes[3 * groups] = (uint8_t)(a << 2 | b >> 4);
+        if (tail == 2)
+            bytes[3 * groups + 1] = (uint8_t)(b << 4 | c >> 2);
+    }
+    return true;
+}
+
+enum class GltfSection {
+    BUFFERS,
+    BUFFER_VIEWS,
+    NODES,
+    MESHES,
+    ACCESSORS,
+    MATERIALS,
+    ANIMATIONS,
+    CAMERAS,
+    OTHER
+};
+
+static GltfSection
+gltf_section(const std::string &key)
+{
+    static const std::pair<const char*, GltfSection> sections[] = {
+        {"buffers", GltfSection::BUFFERS},
+        {"bufferViews", GltfSection::BUFFER_VIEWS},
+        {"nodes", GltfSection::NODES},
+        {"meshes", GltfSection::MESHES},
+        {"accessors", GltfSection::ACCESSORS},
+        {"materials", GltfSection::MATERIALS},
+        {"animations", GltfSection::ANIMATIONS},
+        {"cameras", GltfSection::CAMERAS},
+    };
+    for (const auto &section : sections)
+        if (key == section.first)
+            return section.second;
+    return GltfSection::OTHER;
+}
+
+static std::optional<MeshoptMode>
+meshopt_mode(std::string_view name)
+{
+    if (name == "ATTRIBUTES")
+        return MeshoptMode::ATTRIBUTES;
+    if (name == "TRIANGLES")
+        return MeshoptMode::TRIANGLES;
+    if (name == "INDICES")
+        return MeshoptMode::INDICES;
+    return {};
+}
+
+// Unknown filters decode unfiltered, as if the data had none.
+static MeshoptFilter
+meshopt_filter(std::string_view name)
+{
+    if (name == "OCTAHEDRAL")
+        return MeshoptFilter::OCTAHEDRAL;
+    if (name == "QUATERNION")
+        return MeshoptFilter::QUATERNION;
+    if (name == "EXPONENTIAL")
+        return MeshoptFilter::EXPONENTIAL;
+    return MeshoptFilter::NONE;
+}
+
+/*
+ * SAX handler keeping the path from the root to the current value: the key
+ * last seen in every enclosing object and the position in every enclosing
+ * array. Elements of the top level arrays are appended when their objects
+ * start and filled in as their values arrive.
+ */
+class GltfJsonHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, GltfJsonHandler> {
+public:
+    explicit GltfJsonHandler(GltfDocument &document) : document(document) {}
+
+    bool Null() { begin_value(); return true; }
+    bool Bool(bool value)
+    {
+        begin_value();
+        boolean(value);
+        return true;
+    }
+    bool Int(int value) { return number(value); }
+    bool Uint(unsigned value) { return number(value); }
+    bool Int64(int64_t value) { return number((double)value); }
+    bool Uint64(uint64_t value) { return number((double)value); }
+    bool Double(double value) { return number(value); }
+    bool String(const char *value, rapidjson::SizeType length, bool)
+    {
+        begin_value();
+        string(std::string_view(value, length));
+        return true;
+    }
+    bool StartObject()
+    {
+        begin_value();
+        start_object();
+        path.push_back({{}, 0, false});
+        return true;
+    }
+    bool Key(const char *key, rapidjson::SizeType length, bool)
+    {
+        path.back().key.assign(key, length);
+        if (path.size() == 1)
+            section = gltf_section(path.back().key);
+        return true;
+    }
+    bool EndObject(rapidjson::SizeType)
+    {
+        path.pop_back();
+        end_object();
+        return true;
+    }
+    bool StartArray()
+    {
+        begin_value();
+        path.push_back({{}, SIZE_MAX, true});
+        return true;
+    }
+    bool EndArray(rapidjson::SizeType)
+    {
+        path.pop_back();
+        if (section == GltfSection::NODES && path.size() == 3 && is(2, "matrix")) {
+            float transition[4][4];
+            for (int i = 0; i < 16; i++)
+                transition[i % 4][i / 4] = matrix[i];
+            document.nodes.back().transition = Transform(transition);
+        }
+        return true;
+    }
+
+private:
+    struct Level {
+        std::string key;
+        std::size_t index;
+        bool array;
+    };
+
+    bool is(std::size_t level, const char *key) const { return path[level].key == key; }
+    std::size_t index(std::size_t level) const { return path[level].index; }
+
+    void begin_value()
+    {
+        if (!path.empty() && path.back().array)
+            path.back().index++;
+    }
+
+    // Called with the path leading to the new object, before it is entered.
+    void start_object()
+    {
+        const auto depth = path.size();
+        if (depth == 2 && path[1].array) {
+            switch (section) {
+            case GltfSection::BUFFERS: document.buffers.emplace_back(); break;
+            case GltfSection::BUFFER_VIEWS: document.buffer_views.emplace_back(); break;
+            case GltfSection::NODES: document.nodes.emplace_back(); break;
+            case GltfSection::MESHES: document.meshes.emplace_back(); break;
+            case GltfSection::ACCESSORS: document.accessors.emplace_back(); break;
+            case GltfSection::MATERIALS: document.materials.emplace_back(); emissive_strength = 1.f; break;
+            case GltfSection::ANIMATIONS: document.animations.emplace_back(); break;
+            case GltfSection::CAMERAS: document.camera_fovs.emplace_back(); break;
+            case GltfSection::OTHER: break;
+            }
+        } else if (depth == 4 && section == GltfSection::BUFFER_VIEWS && path[1].array && !path[2].array &&
+                   is(2, "extensions") && is(3, "EXT_meshopt_compression")) {
+            document.buffer_views.back().meshopt.emplace();
+        } else if (depth == 4 && path[1].array && path[3].array) {
+            if (section == GltfSection::MESHES && is(2, "primitives"))
+                document.meshes.back().primitives.emplace_back();
+            else if (section == GltfSection::ANIMATIONS && is(2, "samplers"))
+                document.animations.back().samplers.emplace_back();
+            else if (section == GltfSection::ANIMATIONS && is(2, "channels"))
+                document.animations.back().channels.emplace_back();
+        }
+    }
+
+    // Called with the path leading to the finished object.
+    void end_object()
+    {
+        if (path.size() != 2 || !path[1].array)
+            return;
+        if (section == GltfSection::NODES) {
+            auto &node = document.nodes.back();
+            if (!node.transition.has_value())
+                node.transition = Transform(node.translation, node.rotation, node.scale);
+        } else if (section == GltfSection::MATERIALS) {
+            auto &material = document.materials.back();
+            material.emission *= emissive_strength;
+            if (material.alpha < 1)
+                material.material = Material::DIELECTRIC;
+            else if (material.metallic_factor > 0)
+                material.material = Material::METALLIC;
+        }
+    }
+
+    bool number(double value)
+    {
+        begin_value();
+        const auto depth = path.size();
+        // Everything read lies inside an element object of a top level array.
+        if (depth < 3 || !path[1].array || path[2].array)
+            return true;
+        // Indices, counts, offsets and lengths fail the parse unless they are integers that fit a size_t.
+        const bool integral = value >= 0. && value < 0x1p64 && std::floor(value) == value;
+        bool size_read = false;
+        auto size = [&] {
+            size_read = true;
+            return integral ? (std::size_t)value : SIZE_MAX;
+        };
+        const auto component = (float)value;
+        switch (section) {
+        case GltfSection::BUFFERS:
+            if (depth == 3 && is(2, "byteLength"))
+                document.buffers.back().byte_length = size();
+            break;
+        case GltfSection::BUFFER_VIEWS: {
+            auto &view = document.buffer_views.back();
+            if (depth == 5 && view.meshopt.has_value() && is(2, "extensions") &&
+                is(3, "EXT_meshopt_compression")) {
+                auto &meshopt = view.meshopt.value();
+                if (is(4, "buffer"))
+                    meshopt.buffer = size();
+                else if (is(4, "byteOffset"))
+                    meshopt.byte_offset = size();
+                else if (is(4, "byteLength"))
+                    meshopt.byte_length = size();
+                else if (is(4, "byteStride"))
+                    meshopt.byte_stride = size();
+                else if (is(4, "count"))
+                    meshopt.count = size();
+            }
+            if (depth != 3)
+                break;
+            if (is(2, "buffer"))
+                view.buffer = size();
+            else if (is(2, "byteLength"))
+                view.byte_length = size();
+            else if (is(2, "byteOffset"))
+                view.byte_offset = size();
+            else if (is(2, "byteStride"))
+                view.byte_stride = size();
+            break;
+        }
+        case GltfSection::NODES: {
+            auto &node = document.nodes.back();
+            if (depth == 3 && is(2, "mesh"))
+                node.mesh = size();
+            else if (depth == 3 && is(2, "camera"))
+                node.camera = size();
+            else if (depth == 4 && is(2, "extras") && is(3, "material"))
+                node.shape.material = size();
+            else if (depth == 5 && is(2, "extras") && is(3, "size") && index(4) < 3)
+                node.shape.size[(int)index(4)] = component;
+            else if (depth == 5 && is(2, "extras") && is(3, "normal") && index(4) < 3)
+                node.shape.normal[(int)index(4)] = component;
+            else if (depth == 5 && is(2, "extras") && is(3, "extent") && index(4) < 3)
+                node.shape.extent[(int)index(4)] = component;
+            else if (depth != 4)
+                break;
+            else if (is(2, "children"))
+                node.children.push_back(size());
+            else if (is(2, "matrix") && index(3) < 16)
+                matrix[index(3)] = component;
+            else if (is(2, "rotation") && index(3) < 4)
+                // Stored as (x, y, z, w).
+                (index(3) == 0 ? node.rotation.x : index(3) == 1 ? node.rotation.y :
+                 index(3) == 2 ? node.rotation.z : node.rotation.w) = component;
+            else if (is(2, "translation") && index(3) < 3)
+                node.translation[(int)index(3)] = component;
+            else if (is(2, "scale") && index(3) < 3)
+                node.scale[(int)index(3)] = component;
+            break;
+        }
+        case GltfSection::MESHES: {
+            if (depth < 5 || !is(2, "primitives") || document.meshes.back().primitives.empty())
+                break;
+            auto &primitive = document.meshes.back().primitives.back();
+            if (depth == 5 && is(4, "indices"))
+                primitive.indices = size();
+            else if (depth == 5 && is(4, "material"))
+                primitive.material = size();
+            else if (depth == 6 && is(4, "attributes") && is(5, "POSITION"))
+                primitive.positions = size();
+            break;
+        }
+        case GltfSection::ACCESSORS: {
+            auto &accessor = document.accessors.back();
+            if (depth != 3)
+                break;
+            if (is(2, "bufferView"))
+                accessor.buffer_view = size();
+            else if (is(2, "count"))
+                accessor.count = size();
+            else if (is(2, "componentType"))
+                accessor.component_type = size();
+            else if (is(2, "byteOffset"))
+                accessor.byte_offset = size();
+            break;
+        }
+        case GltfSection::MATERIALS: {
+            auto &material = document.materials.back();
+            if (depth == 4 && is(2, "emissiveFactor") && index(3) < 3) {
+                material.emission[(int)index(3)] = component;
+            } else if (depth == 4 && is(2, "pbrMetallicRoughness") && is(3, "metallicFactor")) {
+                material.metallic_factor = component;
+            } else if (depth == 5 && is(2, "pbrMetallicRoughness") && is(3, "baseColorFactor")) {
+                if (index(4) < 3)
+                    material.color[(int)index(4)] = component;
+                else if (index(4) == 3)
+                    material.alpha = component;
+            } else if (depth == 5 && is(2, "extensions") && is(3, "KHR_materials_emissive_strength") &&
+                       is(4, "emissiveStrength")) {
+                emissive_strength = component;
+            }
+            break;
+        }
+        case GltfSection::ANIMATIONS: {
+            if (depth < 5)
+                break;
+            auto &animation = document.animations.back();
+            if (is(2, "samplers") && !animation.samplers.empty()) {
+                if (depth == 5 && is(4, "input"))
+                    animation.samplers.back().input = size();
+                else if (depth == 5 && is(4, "output"))
+                    animation.samplers.back().output = size();
+            } else if (is(2, "channels") && !animation.channels.empty()) {
+                if (depth == 5 && is(4, "sampler"))
+                    animation.channels.back().sampler = size();
+                else if (depth == 6 && is(4, "target") && is(5, "node"))
+                    animation.channels.back().node = size();
+            }
+            break;
+        }
+        case GltfSection::CAMERAS:
+            if (depth == 4 && is(2, "perspective") && is(3, "yfov"))
+                document.camera_fovs.back() = component;
+            break;
+        case GltfSection::OTHER:
+            break;
+        }
+        return integral || !size_read;
+    }
+
+    void string(std::string_view value)
+    {
+        const auto depth = path.size();
+        if (depth < 3 || !path[1].array || path[2].array)
+            return;
+        if (section == GltfSection::BUFFERS && depth == 3 && is(2, "uri")) {
+            document.buffers.back().uri = value;
+        } else if (section == GltfSection::NODES && depth == 4 && is(2, "extras") && is(3, "shape")) {
+            auto &shape = document.nodes.back().shape;
+            if (value == "ellipsoid")
+                shape.type = GltfShapeType::ELLIPSOID;
+            else if (value == "box")
+                shape.type = GltfShapeType::BOX;
+            else if (value == "plane")
+                shape.type = GltfShapeType::PLANE;
+        } else if (section == GltfSection::ACCESSORS && depth == 3 && is(2, "type")) {
+            document.accessors.back().type = value;
+        } else if (section == GltfSection::BUFFER_VIEWS && depth == 5 && is(2, "extensions") &&
+                   is(3, "EXT_meshopt_compression") && document.buffer_views.back().meshopt.has_value()) {
+            auto &meshopt = document.buffer_views.back().meshopt.value();
+            if (is(4, "mode"))
+                meshopt.mode = meshopt_mode(value);
+            else if (is(4, "filter"))
+                meshopt.filter = meshopt_filter(value);
+        } else if (section == GltfSection::ANIMATIONS && depth == 5 && is(2, "samplers") &&
+                   is(4, "interpolation") && !document.animations.back().samplers.empty()) {
+            auto &sampler = document.animations.back().samplers.back();
+            if (value == "STEP")
+                sampler.interpolation = GltfInterpolation::STEP;
+            else if (value == "CUBICSPLINE")
+                sampler.interpolation = GltfInterpolation::CUBICSPLINE;
+        } else if (section == GltfSection::ANIMATIONS && depth == 6 && is(2, "channels") && is(4, "target") &&
+                   is(5, "path") && !document.animations.back().channels.empty()) {
+            auto &channel = document.animations.back().channels.back();
+            if (value == "translation")
+                channel.path = GltfAnimationPath::TRANSLATION;
+            else if (value == "rotation")
+                channel.path = GltfAnimationPath::ROTATION;
+            else if (value == "scale")
+                channel.path = GltfAnimationPath::SCALE;
+        }
+    }
+
+    void boolean(bool value)
+    {
+        const auto depth = path.size();
+        if (depth < 3 || !path[1].array || path[2].array)
+            return;
+        if (section == GltfSection::ACCESSORS && depth == 3 && is(2, "normalized"))
+            document.accessors.back().normalized = value;
+        else if (section == GltfSection::BUFFERS && depth == 5 && is(2, "extensions") &&
+                 is(3, "EXT_meshopt_compression") && is(4, "fallback"))
+            document.buffers.back().fallback = value;
+    }
+
+    GltfDocument &document;
+    std::vector<Level> path;
+    GltfSection section = GltfSection::OTHER;
+    float matrix[16] = {};
+    float emissive_strength = 1.f;
+};
+
+bool
+parse_gltf_json(char *json, std::size_t length, bool spare_byte, GltfDocument &document)
+{
+    GltfJsonHandler handler(document);
+    rapidjson::Reader reader;
+    rapidjson::ParseResult result;
+    const char last = (length > 0) ? json[length - 1] : 'x';
+    const bool padded = last == ' ' || last == '\n' || last == '\r' || last == '\t' || last == '\0';
+    if (padded || spare_byte) {
+        json[padded ? length - 1 : length] = '\0';
+        rapidjson::InsituStringStream stream(json);
+        result = reader.Parse<rapidjson::kParseInsituFlag>(stream, handler);
+    } else {
+        rapidjson::MemoryStream stream(json, length);
+        result = reader.Parse(stream, handler);
+    }
+    if (result.IsError())
+        std::cerr << "glTF JSON error at byte " << result.Offset() << ": "
+                  << rapidjson::GetParseError_En(result.Code()) << std::endl;
+    return !result.IsError();
+}
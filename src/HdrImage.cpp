@@ -0,0 +1,258 @@
+#include <HdrImage.hpp>
+
+#include <utils.hpp>
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+static const int32_t exr_magic = 20000630;
+static const int32_t exr_version = 2;
+
+enum class ExrPixelType {
+	UINT = 0,
+	HALF = 1,
+	FLOAT = 2
+};
+
+struct ExrChannel {
+	std::string name;
+	ExrPixelType type;
+	int index;
+};
+
+HdrImage::HdrImage(int height, int width, int channels, std::vector<float> data) :
+	m_width(width),
+	m_height(height),
+	m_channels(channels),
+	data(std::move(data))
+{
+	assert(channels == 1 || channels == 3);
+	assert(this->data.size() == (size_t)height * width * channels);
+}
+
+HdrImage::HdrImage(int height, int width, const std::vector<Color> &pixels) :
+	m_width(width),
+	m_height(height),
+	m_channels(3),
+	data((const float*)pixels.data(), (const float*)pixels.data() + 3 * pixels.size())
+{
+	assert(pixels.size() == (size_t)height * width);
+}
+
+Color
+HdrImage::get_pixel(int pixel) const
+{
+	if (m_channels == 1)
+		return Color(data[pixel]);
+	return {data[3 * pixel + 0], data[3 * pixel + 1], data[3 * pixel + 2]};
+}
+
+std::vector<Color>
+HdrImage::pixels() const
+{
+	std::vector<Color> result((size_t)m_height * m_width);
+	#pragma omp parallel for schedule(static)
+	for (int pixel = 0; pixel < (int)result.size(); pixel++)
+		result[pixel] = get_pixel(pixel);
+	return result;
+}
+
+void
+HdrImage::save_pfm(std::ofstream &out) const
+{
+	// PFM stores the bottom row first; a negative scale marks little-endian data.
+	out << ((m_channels == 3) ? "PF" : "Pf") << '\n' << m_width << ' ' << m_height << "\n-1.0\n";
+	const size_t row = (size_t)m_width * m_channels;
+	for (int i = m_height - 1; i >= 0; i--)
+		out.write((const char*)(data.data() + i * row), (std::streamsize)(row * sizeof(float)));
+}
+
+static void
+write_exr_attribute(std::ofstream &out, const char *name, const char *type, const void *value, int32_t size)
+{
+	out.write(name, (std::streamsize)strlen(name) + 1);
+	out.write(type, (std::streamsize)strlen(type) + 1);
+	out.write((const char*)&size, sizeof(size));
+	out.write((const char*)value, size);
+}
+
+// Channels sorted by name, as OpenEXR requires.
+static std::vector<ExrChannel>
+exr_channels(int channels)
+{
+	if (channels == 1)
+		return {{"Y", ExrPixelType::HALF, 0}};
+	return {{"B", ExrPixelType::HALF, 2}, {"G", ExrPixelType::HALF, 1}, {"R", ExrPixelType::HALF, 0}};
+}
+
+void
+HdrImage::save_exr(std::ofstream &out) const
+{
+	auto channels = exr_channels(m_channels);
+	std::vector<char> channel_list;
+	for (const auto &channel : channels) {
+		int32_t fields[4] = {(int32_t)channel.type, 0, 1, 1};
+		channel_list.insert(channel_list.end(), channel.name.begin(), channel.name.end());
+		channel_list.push_back('\0');
+		channel_list.insert(channel_list.end(), (const char*)fields, (const char*)fields + sizeof(fields));
+	}
+	channel_list.push_back('\0');
+
+	const uint8_t compression = 0, line_order = 0;
+	const int32_t window[4] = {0, 0, m_width - 1, m_height - 1};
+	const float aspect = 1.f, screen_center[2] = {0.f, 0.f}, screen_width = 1.f;
+	out.write((const char*)&exr_magic, sizeof(exr_magic));
+	out.write((const char*)&exr_version, sizeof(exr_version));
+	write_exr_attribute(out, "channels", "chlist", channel_list.data(), (int32_t)channel_list.size());
+	write_exr_attribute(out, "compression", "compression", &compression, sizeof(compression));
+	write_exr_attribute(out, "dataWindow", "box2i", window, sizeof(window));
+	write_exr_attribute(out, "displayWindow", "box2i", window, sizeof(window));
+	write_exr_attribute(out, "lineOrder", "lineOrder", &line_order, sizeof(line_order));
+	write_exr_attribute(out, "pixelAspectRatio", "float", &aspect, sizeof(aspect));
+	write_exr_attribute(out, "screenWindowCenter", "v2f", screen_center, sizeof(screen_center));
+	write_exr_attribute(out, "screenWindowWidth", "float", &screen_width, sizeof(screen_width));
+	out.put('\0');
+
+	// Every scanline is a y coordinate, a byte count and then each channel's row in turn.
+	const int32_t line_size = (int32_t)(m_width * channels.size() * sizeof(uint16_t));
+	uint64_t offset = (uint64_t)out.tellp() + (uint64_t)m_height * sizeof(uint64_t);
+	for (int i = 0; i < m_height; i++, offset += 2 * sizeof(int32_t) + line_size)
+		out.write((const char*)&offset, sizeof(offset));
+
+	std::vector<uint16_t> line((size_t)m_width * channels.size());
+	for (int32_t i = 0; i < m_height; i++) {
+		for (size_t c = 0; c < channels.size(); c++)
+			for (int j = 0; j < m_width; j++)
+				line[c * m_width + j] = glm::packHalf1x16(
+					data[((size_t)i * m_width + j) * m_channels + channels[c].index]);
+		out.write((const char*)&i, sizeof(i));
+		out.write((const char*)&line_size, sizeof(line_size));
+		out.write((const char*)line.data(), line_size);
+	}
+}
+
+static bool
+load_pfm(std::ifstream &in, HdrImage &image)
+{
+	std::string magic;
+	float scale;
+	in >> magic >> image.m_width >> image.m_height >> scale;
+	in.get();
+	if (!in || (magic != "PF" && magic != "Pf") || image.m_width <= 0 || image.m_height <= 0)
+		return false;
+	image.m_channels = (magic == "PF") ? 3 : 1;
+	const size_t row = (size_t)image.m_width * image.m_channels;
+	image.data.resize(row * image.m_height);
+	for (int i = image.m_height - 1; i >= 0; i--)
+		in.read((char*)(image.data.data() + i * row), (std::streamsize)(row * sizeof(float)));
+	if (scale > 0.f) {
+		for (auto &value : image.data) {
+			auto bytes = (char*)&value;
+			std::reverse(bytes, bytes + sizeof(float));
+		}
+	}
+	return (bool)in;
+}
+
+// Reads uncompressed scanline files with R, G, B or Y channels.
+static bool
+load_exr(std::ifstream &in, HdrImage &image)
+{
+	int32_t magic, version;
+	in.read((char*)&magic, sizeof(magic));
+	in.read((char*)&version, sizeof(version));
+	if (!in || magic != exr_magic || (version & 0xff) != exr_version || (version & ~0xff) != 0)
+		return false;
+
+	std::vector<ExrChannel> channels;
+	int32_t window[4] = {0, 0, -1, -1};
+	uint8_t compression = 0xff;
+	while (true) {
+		std::string name, type;
+		std::getline(in, name, '\0');
+		if (!in || name.empty())
+			break;
+		std::getline(in, type, '\0');
+		int32_t size;
+		in.read((char*)&size, sizeof(size));
+		if (!in || size < 0)
+			return false;
+		std::vector<char> value(size);
+		in.read(value.data(), size);
+		if (name == "compression" && size == 1) {
+			compression = (uint8_t)value[0];
+		} else if (name == "dataWindow" && size == sizeof(window)) {
+			memcpy(window, value.data(), sizeof(window));
+		} else if (name == "channels") {
+			for (size_t pos = 0; pos < value.size() && value[pos] != '\0';) {
+				ExrChannel channel;
+				channel.name = value.data() + pos;
+				pos += channel.name.size() + 1;
+				if (pos + 16 > value.size())
+					return false;
+				int32_t pixel_type;
+				memcpy(&pixel_type, value.data() + pos, sizeof(pixel_type));
+				pos += 16;
+				channel.type = (ExrPixelType)pixel_type;
+				channel.index = (channel.name == "G") ? 1 : (channel.name == "B") ? 2 : 0;
+				channels.push_back(channel);
+			}
+		}
+	}
+	if (!in || compression != 0 || channels.empty() || channels.size() == 2 || channels.size() > 3)
+		return false;
+	for (const auto &channel : channels)
+		if (channel.type == ExrPixelType::UINT)
+			return false;
+
+	image.m_width = window[2] - window[0] + 1;
+	image.m_height = window[3] - window[1] + 1;
+	image.m_channels = (int)channels.size();
+	if (image.m_width <= 0 || image.m_height <= 0)
+		return false;
+	image.data.assign((size_t)image.m_width * image.m_height * image.m_channels, 0.f);
+	in.seekg((std::streamoff)image.m_height * sizeof(uint64_t), std::ios::cur);
+
+	std::vector<char> line;
+	for (int i = 0; i < image.m_height; i++) {
+		int32_t y, size;
+		in.read((char*)&y, sizeof(y));
+		in.read((char*)&size, sizeof(size));
+		y -= window[1];
+		if (!in || y < 0 || y >= image.m_height || size < 0)
+			return false;
+		line.resize(size);
+		in.read(line.data(), size);
+		size_t pos = 0;
+		for (const auto &channel : channels) {
+			const size_t bytes = (channel.type == ExrPixelType::HALF) ? sizeof(uint16_t) : sizeof(float);
+			if (pos + bytes * image.m_width > line.size())
+				return false;
+			for (int j = 0; j < image.m_width; j++, pos += bytes) {
+				float value;
+				if (channel.type == ExrPixelType::HALF) {
+					uint16_t half;
+					memcpy(&half, line.data() + pos, sizeof(half));
+					value = glm::unpackHalf1x16(half);
+				} else {
+					memcpy(&value, line.data() + pos, sizeof(value));
+				}
+				const int index = (image.m_channels == 1) ? 0 : channel.index;
+				image.data[((size_t)y * image.m_width + j) * image.m_channels + index] = value;
+			}
+		}
+	}
+	return (bool)in;
+}
+
+bool
+HdrImage::load(std::ifstream &in)
+{
+	char magic = (char)in.peek();
+	if (magic == 'P')
+		return load_pfm(in, *this);
+	return load_exr(in, *this);
+}
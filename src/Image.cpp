@@ -1,5 +1,6 @@
 #include <Image.hpp>
 
+#include <algorithm>
 #include <cmath>
 
 Image::Image(int height, int width) :
@@ -13,16 +14,12 @@ Image::set_pixel(int i, int j, Color color)
 	assert(0 <= i && i < m_height);
 	assert(0 <= j && j < m_width);
 	auto ind = 3 * (i * m_width + j);
-	assert(0.f <= color.x && color.x <= 1.f);
-	assert(0.f <= color.y && color.y <= 1.f);
-	assert(0.f <= color.z && color.z <= 1.f);
-	raw[ind + 0] = (uint8_t)round(255.0 * color.x);
-	raw[ind + 1] = (uint8_t)round(255.0 * color.y);
-	raw[ind + 2] = (uint8_t)round(255.0 * color.z);
+	for (int c = 0; c < 3; c++)
+		raw[ind + c] = (uint8_t)lrintf(255.f * std::min(1.f, std::max(0.f, color[c])));
 }
 
 void
-Image::save(std::ofstream &out)
+Image::save(std::ostream &out) const
 {
 	out << "P6\n";
 	out << m_width << ' ' << m_height << '\n';
@@ -0,0 +1,345 @@
+#include <Job.hpp>
+
+#include <Denoiser.hpp>
+#include <Distributed.hpp>
+#include <HdrImage.hpp>
+#include <PostProcess.hpp>
+#include <render.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+const char *job_usage = "scene width height samples output"
+	" [--checkpoint file] [--resume file] [--preview file] [--pass-samples n]"
+	" [--sampler independent|stratified|sobol] [--denoise] [--aov name=file]..."
+	" [--hdr file.pfm|file.exr] [--exposure stops]"
+	" [--cameras all|poses.txt] [--frames n] [--fps f] [--workers n] [--tile-size pixels] [--tile-timeout seconds] [--worker-command command]";
+
+static bool
+parse_sampler_type(const char *name, SamplerType &type)
+{
+	if (strcmp(name, "independent") == 0)
+		type = SamplerType::INDEPENDENT;
+	else if (strcmp(name, "stratified") == 0)
+		type = SamplerType::STRATIFIED;
+	else if (strcmp(name, "sobol") == 0)
+		type = SamplerType::SOBOL;
+	else
+		return false;
+	return true;
+}
+
+// Parses "name=file".
+static bool
+parse_aov(const char *value, std::pair<Aov, std::string> &aov)
+{
+	const char *separator = strchr(value, '=');
+	if (separator == nullptr)
+		return false;
+	std::string name(value, separator);
+	for (int i = 0; i < (int)Aov::AOVS_NUMBER; i++) {
+		if (name == aov_name((Aov)i)) {
+			aov = {(Aov)i, separator + 1};
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+parse_options(int argc, const char *argv[], int first, RenderOptions &options)
+{
+	for (int i = first; i < argc; i++) {
+		if (strcmp(argv[i], "--denoise") == 0) {
+			options.denoise = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+		const char *value = argv[++i];
+		if (strcmp(argv[i - 1], "--checkpoint") == 0)
+			options.checkpoint = value;
+		else if (strcmp(argv[i - 1], "--resume") == 0)
+			options.resume = value;
+		else if (strcmp(argv[i - 1], "--preview") == 0)
+			options.preview = value;
+		else if (strcmp(argv[i - 1], "--hdr") == 0)
+			options.hdr = value;
+		else if (strcmp(argv[i - 1], "--exposure") == 0)
+			options.exposure = strtof(value, nullptr);
+		else if (strcmp(argv[i - 1], "--cameras") == 0)
+			options.cameras = value;
+		else if (strcmp(argv[i - 1], "--frames") == 0)
+			options.frames = std::max(0, (int)strtol(value, nullptr, 10));
+		else if (strcmp(argv[i - 1], "--fps") == 0)
+			options.fps = std::max(EPS5, strtof(value, nullptr));
+		else if (strcmp(argv[i - 1], "--workers") == 0)
+			options.workers = std::max(0, (int)strtol(value, nullptr, 10));
+		else if (strcmp(argv[i - 1], "--tile-size") == 0)
+			options.tile_size = std::max(1, (int)strtol(value, nullptr, 10));
+		else if (strcmp(argv[i - 1], "--tile-timeout") == 0)
+			options.tile_timeout = std::max(0.f, strtof(value, nullptr));
+		else if (strcmp(argv[i - 1], "--worker-command") == 0)
+			options.worker_command = value;
+		else if (strcmp(argv[i - 1], "--pass-samples") == 0)
+			options.pass_samples = std::max(1, (int)strtol(value, nullptr, 10));
+		else if (strcmp(argv[i - 1], "--sampler") == 0) {
+			if (!parse_sampler_type(value, options.sampler_type))
+				return false;
+		} else if (strcmp(argv[i - 1], "--aov") == 0) {
+			std::pair<Aov, std::string> aov;
+			if (!parse_aov(value, aov))
+				return false;
+			options.aovs.push_back(aov);
+		} else
+			return false;
+	}
+	return true;
+}
+
+bool
+parse_job(int argc, const char *argv[], RenderJob &job)
+{
+	if (argc < 5)
+		return false;
+	job.scene = argv[0];
+	job.width = (int)strtol(argv[1], nullptr, 10);
+	job.height = (int)strtol(argv[2], nullptr, 10);
+	job.samples = (int)strtol(argv[3], nullptr, 10);
+	job.output = argv[4];
+	job.args.assign(argv, argv + argc);
+	if (job.width <= 0 || job.height <= 0 || job.samples <= 0)
+		return false;
+	return parse_options(argc, argv, 5, job.options);
+}
+
+// Linear radiance of the final image.
+static std::vector<Color>
+develop_linear(const Framebuffer &framebuffer, const RenderOptions &options)
+{
+	if (!options.denoise)
+		return framebuffer.resolve();
+	return denoise(framebuffer);
+}
+
+static Image
+develop(const Framebuffer &framebuffer, const RenderOptions &options)
+{
+	return tonemap(develop_linear(framebuffer, options), framebuffer.m_height, framebuffer.m_width,
+		       options.exposure);
+}
+
+static bool
+has_extension(const std::string &path, const char *extension)
+{
+	auto length = strlen(extension);
+	return path.size() >= length && path.compare(path.size() - length, length, extension) == 0;
+}
+
+// Picks half float OpenEXR for .exr and float PFM otherwise.
+static void
+save_hdr(const std::string &path, const HdrImage &image)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (has_extension(path, ".exr"))
+		image.save_exr(out);
+	else
+		image.save_pfm(out);
+}
+
+/*
+ * Numbers the outputs of batch frames: a single "%d" or "%0Nd" as in
+ * "frame%04d.ppm" is replaced by the frame number, other paths, including
+ * ones with any other '%', get "_0000" before the extension. The path is
+ * never used as a format itself, it may come from a server client.
+ */
+static std::string
+frame_path(const std::string &path, int frame)
+{
+	if (frame < 0)
+		return path;
+	char number[16];
+	auto percent = path.find('%');
+	if (percent != std::string::npos && path.find('%', percent + 1) == std::string::npos) {
+		size_t end = percent + 1;
+		int width = 0;
+		if (end < path.size() && path[end] == '0')
+			end++;
+		while (end < path.size() && isdigit((unsigned char)path[end]) && width < 100)
+			width = 10 * width + (path[end++] - '0');
+		if (end < path.size() && path[end] == 'd' && width < (int)sizeof(number)) {
+			snprintf(number, sizeof(number), "%0*d", width, frame);
+			return path.substr(0, percent) + number + path.substr(end + 1);
+		}
+	}
+	snprintf(number, sizeof(number), "_%04d", frame);
+	auto name = path.find_last_of('/');
+	auto dot = path.find_last_of('.');
+	if (dot == std::string::npos || (name != std::string::npos && dot < name))
+		return path + number;
+	return path.substr(0, dot) + number + path.substr(dot);
+}
+
+// Develops the finished framebuffer and writes the HDR and AOV files of one frame.
+static Image
+finish(const Framebuffer &framebuffer, const RenderOptions &options, int frame)
+{
+	auto linear = develop_linear(framebuffer, options);
+	if (!options.hdr.empty())
+		save_hdr(frame_path(options.hdr, frame), HdrImage(framebuffer.m_height, framebuffer.m_width, linear));
+	for (const auto &[aov, path] : options.aovs)
+		save_hdr(frame_path(path, frame), HdrImage(framebuffer.m_height, framebuffer.m_width,
+							   aov_channels(aov), framebuffer.resolve_aov(aov)));
+	return tonemap(linear, framebuffer.m_height, framebuffer.m_width, options.exposure);
+}
+
+// Writes next to the target first, so a killed job never leaves a truncated file behind.
+template <typename Writer>
+static void
+save_atomically(const std::string &path, Writer writer)
+{
+	auto tmp_path = path + ".tmp";
+	std::ofstream out(tmp_path, std::ios::binary);
+	writer(out);
+	out.close();
+	std::filesystem::rename(tmp_path, path);
+}
+
+void
+setup_scene(Scene &scene, const RenderJob &job)
+{
+	scene.camera.width = job.width;
+	scene.camera.height = job.height;
+	scene.samples = job.samples;
+	scene.camera.tan_fov_y = tanf(scene.camera.fov_y * 0.5f);
+	scene.camera.tan_fov_x = scene.camera.tan_fov_y * (float)scene.camera.width / (float)scene.camera.height;
+	scene.ray_depth = 6;
+	scene.sampler_type = job.options.sampler_type;
+}
+
+uint32_t
+job_aov_mask(const RenderJob &job)
+{
+	uint32_t aov_mask = job.options.denoise ? denoiser_aovs : 0;
+	for (const auto &[aov, path] : job.options.aovs)
+		aov_mask |= aov_bit(aov);
+	return aov_mask;
+}
+
+bool
+run_job(Scene &scene, const RenderJob &job, Image &image)
+{
+	const auto &options = job.options;
+	setup_scene(scene, job);
+	Framebuffer framebuffer(scene.camera.height, scene.camera.width, job_aov_mask(job));
+	if (!options.resume.empty()) {
+		std::ifstream in(options.resume, std::ios::binary);
+		if (!framebuffer.load_checkpoint(in)) {
+			std::cerr << "cannot resume from " << options.resume << std::endl;
+			return false;
+		}
+	}
+
+	if (options.workers > 0) {
+		if (!render_distributed(job, framebuffer))
+			return false;
+		if (!options.checkpoint.empty())
+			save_atomically(options.checkpoint, [&](std::ofstream &out) { framebuffer.save_checkpoint(out); });
+	}
+
+	bool progressive = !options.checkpoint.empty() || !options.preview.empty();
+	while ((int)framebuffer.min_samples() < scene.samples) {
+		int done = (int)framebuffer.min_samples();
+		int pass = progressive ? std::min(options.pass_samples, scene.samples - done) : scene.samples - done;
+		render(scene, framebuffer, pass);
+		if (!options.checkpoint.empty())
+			save_atomically(options.checkpoint, [&](std::ofstream &out) { framebuffer.save_checkpoint(out); });
+		if (!options.preview.empty())
+			save_atomically(options.preview, [&](std::ofstream &out) { develop(framebuffer, options).save(out); });
+	}
+
+	image = finish(framebuffer, options, -1);
+	return true;
+}
+
+bool
+load_camera_poses(const std::string &path, float fov_y, std::vector<Camera> &cameras)
+{
+	std::ifstream in(path);
+	if (!in)
+		return false;
+	for (std::string line; std::getline(in, line);) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream words(line);
+		std::vector<float> values;
+		for (float value; words >> value;)
+			values.push_back(value);
+		if (values.size() != 6 && values.size() != 7 && values.size() != 9 && values.size() != 10)
+			return false;
+		glm::vec3 position(values[0], values[1], values[2]);
+		glm::vec3 target(values[3], values[4], values[5]);
+		glm::vec3 up = (values.size() >= 9) ? glm::vec3(values[6], values[7], values[8]) : glm::vec3(0, 1, 0);
+		float fov = (values.size() % 3 == 1) ? glm::radians(values.back()) : fov_y;
+		cameras.push_back(Camera::look_at(position, target, up, fov));
+	}
+	return !cameras.empty();
+}
+
+bool
+run_batch(Scene &scene, const RenderJob &job)
+{
+	const auto &options = job.options;
+	if (options.workers > 0 || !options.checkpoint.empty() || !options.resume.empty() || !options.preview.empty()) {
+		std::cerr << "batches render every frame in one go, without workers, checkpoints or previews" << std::endl;
+		return false;
+	}
+	std::vector<Camera> cameras;
+	if (options.cameras == "all")
+		cameras = scene.cameras;
+	else if (!options.cameras.empty() && !load_camera_poses(options.cameras, scene.camera.fov_y, cameras))
+		cameras.clear();
+	if (!options.cameras.empty() && cameras.empty()) {
+		std::cerr << "no cameras in " << options.cameras << std::endl;
+		return false;
+	}
+	// Animations take their camera from the scene unless poses are given; the last pose is held.
+	const int frames = (options.frames > 0) ? options.frames : (int)cameras.size();
+
+	// Scenes kept by the server are left as they were loaded, cameras included.
+	const auto loaded_camera = scene.camera;
+	const auto loaded_cameras = scene.cameras;
+
+	// Frame N is denoised, tonemapped and written while frame N + 1 renders.
+	std::future<void> encoding;
+	for (int frame = 0; frame < frames; frame++) {
+		if (options.frames > 0)
+			scene.set_time((float)frame / options.fps);
+		if (!cameras.empty())
+			scene.camera = cameras[std::min(frame, (int)cameras.size() - 1)];
+		setup_scene(scene, job);
+		auto framebuffer = std::make_unique<Framebuffer>(job.height, job.width, job_aov_mask(job));
+		render(scene, *framebuffer, scene.samples);
+		if (encoding.valid())
+			encoding.get();
+		encoding = std::async(std::launch::async, [&job, frame, framebuffer = std::move(framebuffer)] {
+			auto image = finish(*framebuffer, job.options, frame);
+			std::ofstream out(frame_path(job.output, frame), std::ios::binary);
+			image.save(out);
+		});
+	}
+	encoding.get();
+	if (options.frames > 0)
+		scene.reset_time();
+	scene.cameras = loaded_cameras;
+	scene.camera = loaded_camera;
+	return true;
+}
@@ -0,0 +1,381 @@
+#include <Meshopt.hpp>
+
+#include <cmath>
+#include <cstring>
+
+static const uint8_t vertex_header = 0xa0;
+static const uint8_t index_header = 0xe0;
+static const uint8_t sequence_header = 0xd0;
+
+static const size_t vertex_block_bytes = 8192;
+static const size_t vertex_block_max_size = 256;
+static const size_t byte_group_size = 16;
+// The most a byte group can read: 4 bytes of 2 bit codes and 16 escaped values.
+static const size_t byte_group_decode_limit = 24;
+static const size_t tail_max_size = 32;
+
+static size_t
+vertex_block_size(size_t vertex_size)
+{
+	size_t result = vertex_block_bytes / vertex_size;
+	result &= ~(byte_group_size - 1);
+	return (result < vertex_block_max_size) ? result : vertex_block_max_size;
+}
+
+static inline uint8_t
+unzigzag8(uint8_t v)
+{
+	return (uint8_t)(-(v & 1) ^ (v >> 1));
+}
+
+// One group of 16 deltas stored with 0, 2, 4 or 8 bits each; the all-ones code escapes to a full byte.
+static const uint8_t *
+decode_bytes_group(const uint8_t *data, uint8_t *buffer, int bits_log2)
+{
+	if (bits_log2 == 0) {
+		memset(buffer, 0, byte_group_size);
+		return data;
+	}
+	if (bits_log2 == 3) {
+		memcpy(buffer, data, byte_group_size);
+		return data + byte_group_size;
+	}
+	const int bits = 1 << bits_log2;
+	const uint8_t escape = (uint8_t)((1 << bits) - 1);
+	const uint8_t *escaped = data + byte_group_size * bits / 8;
+	for (size_t i = 0; i < byte_group_size; i++) {
+		const int shift = 8 - bits - (int)(i * bits % 8);
+		const uint8_t code = (uint8_t)((data[i * bits / 8] >> shift) & escape);
+		buffer[i] = (code == escape) ? *escaped++ : code;
+	}
+	return escaped;
+}
+
+static const uint8_t *
+decode_bytes(const uint8_t *data, const uint8_t *data_end, uint8_t *buffer, size_t buffer_size)
+{
+	const uint8_t *header = data;
+	const size_t header_size = (buffer_size / byte_group_size + 3) / 4;
+	if ((size_t)(data_end - data) < header_size)
+		return nullptr;
+	data += header_size;
+	for (size_t i = 0; i < buffer_size; i += byte_group_size) {
+		if ((size_t)(data_end - data) < byte_group_decode_limit)
+			return nullptr;
+		const size_t group = i / byte_group_size;
+		const int bits_log2 = (header[group / 4] >> ((group % 4) * 2)) & 3;
+		data = decode_bytes_group(data, buffer + i, bits_log2);
+	}
+	return data;
+}
+
+/*
+ * Vertices are split into blocks, and every byte position of a block is
+ * stored as its own stream of zigzag deltas from the previous vertex.
+ */
+static bool
+decode_vertices(uint8_t *out, size_t count, size_t vertex_size, const uint8_t *data, size_t size)
+{
+	const size_t tail_size = (vertex_size < tail_max_size) ? tail_max_size : vertex_size;
+	if (vertex_size == 0 || vertex_size > 256 || vertex_size % 4 != 0 || size < 1 + tail_size)
+		return false;
+	const uint8_t *data_end = data + size;
+	if ((*data & 0xf0) != vertex_header || (*data & 0x0f) > 0)
+		return false;
+	data++;
+
+	uint8_t last_vertex[256];
+	memcpy(last_vertex, data_end - vertex_size, vertex_size);
+	const size_t block_size = vertex_block_size(vertex_size);
+	uint8_t deltas[vertex_block_max_size];
+	for (size_t first = 0; first < count; first += block_size) {
+		const size_t vertices = (first + block_size < count) ? block_size : count - first;
+		const size_t aligned = (vertices + byte_group_size - 1) & ~(byte_group_size - 1);
+		uint8_t *block = out + first * vertex_size;
+		for (size_t k = 0; k < vertex_size; k++) {
+			data = decode_bytes(data, data_end, deltas, aligned);
+			if (data == nullptr)
+				return false;
+			uint8_t p = last_vertex[k];
+			for (size_t i = 0; i < vertices; i++) {
+				p = (uint8_t)(unzigzag8(deltas[i]) + p);
+				block[i * vertex_size + k] = p;
+			}
+		}
+		memcpy(last_vertex, block + (vertices - 1) * vertex_size, vertex_size);
+	}
+	return (size_t)(data_end - data) == tail_size;
+}
+
+static uint32_t
+decode_vbyte(const uint8_t *&data)
+{
+	uint8_t lead = *data++;
+	if (lead < 128)
+		return lead;
+	uint32_t result = lead & 127;
+	uint32_t shift = 7;
+	// At most 4 more bytes, so malformed data cannot run on.
+	for (int i = 0; i < 4; i++) {
+		uint8_t group = *data++;
+		result |= (uint32_t)(group & 127) << shift;
+		shift += 7;
+		if (group < 128)
+			break;
+	}
+	return result;
+}
+
+static uint32_t
+decode_index(const uint8_t *&data, uint32_t last)
+{
+	uint32_t v = decode_vbyte(data);
+	uint32_t d = (v >> 1) ^ (uint32_t)-(int32_t)(v & 1);
+	return last + d;
+}
+
+static void
+write_index(uint8_t *out, size_t index_size, size_t i, uint32_t value)
+{
+	if (index_size == 2) {
+		uint16_t narrow = (uint16_t)value;
+		memcpy(out + 2 * i, &narrow, sizeof(narrow));
+	} else {
+		memcpy(out + 4 * i, &value, sizeof(value));
+	}
+}
+
+/*
+ * Triangles refer back to a FIFO of the 16 most recent edges and one of the
+ * 16 most recent vertices; everything else is the next new vertex or a
+ * delta coded free index.
+ */
+static bool
+decode_triangles(uint8_t *out, size_t count, size_t index_size, const uint8_t *buffer, size_t size)
+{
+	if (count % 3 != 0 || (index_size != 2 && index_size != 4) || size < 1 + count / 3 + 16)
+		return false;
+	if ((buffer[0] & 0xf0) != index_header || (buffer[0] & 0x0f) > 1)
+		return false;
+	const int version = buffer[0] & 0x0f;
+
+	uint32_t edges[16][2], vertices[16];
+	memset(edges, -1, sizeof(edges));
+	memset(vertices, -1, sizeof(vertices));
+	size_t edge_offset = 0, vertex_offset = 0;
+	uint32_t next = 0, last = 0;
+	const int fec_max = (version >= 1) ? 13 : 15;
+
+	auto push_edge = [&](uint32_t a, uint32_t b) {
+		edges[edge_offset][0] = a;
+		edges[edge_offset][1] = b;
+		edge_offset = (edge_offset + 1) & 15;
+	};
+	auto push_vertex = [&](uint32_t v, bool advance) {
+		vertices[vertex_offset] = v;
+		vertex_offset = (vertex_offset + advance) & 15;
+	};
+	auto write_triangle = [&](size_t i, uint32_t a, uint32_t b, uint32_t c) {
+		write_index(out, index_size, i, a);
+		write_index(out, index_size, i + 1, b);
+		write_index(out, index_size, i + 2, c);
+	};
+
+	const uint8_t *code = buffer + 1;
+	const uint8_t *data = code + count / 3;
+	// The codeaux table takes the last 16 bytes, which also bounds every triangle's reads.
+	const uint8_t *data_safe_end = buffer + size - 16;
+	const uint8_t *codeaux_table = data_safe_end;
+	for (size_t i = 0; i < count; i += 3) {
+		if (data > data_safe_end)
+			return false;
+		const uint8_t codetri = *code++;
+		if (codetri < 0xf0) {
+			// An edge from the FIFO plus a third vertex.
+			const int fe = codetri >> 4;
+			const uint32_t a = edges[(edge_offset - 1 - fe) & 15][0];
+			const uint32_t b = edges[(edge_offset - 1 - fe) & 15][1];
+			const int fec = codetri & 15;
+			uint32_t c;
+			if (fec < fec_max) {
+				c = (fec == 0) ? next : vertices[(vertex_offset - 1 - fec) & 15];
+				next += (fec == 0);
+				push_vertex(c, fec == 0);
+			} else {
+				// 13 and 14 are the last free index -1 and +1.
+				c = (fec != 15) ? last + (fec - (fec ^ 3)) : decode_index(data, last);
+				last = c;
+				push_vertex(c, true);
+			}
+			write_triangle(i, a, b, c);
+			push_edge(c, b);
+			push_edge(a, c);
+		} else if (codetri < 0xfe) {
+			// Three vertices, the first one new, the others described by the codeaux table.
+			const uint8_t codeaux = codeaux_table[codetri & 15];
+			const int feb = codeaux >> 4, fec = codeaux & 15;
+			const uint32_t a = next++;
+			const uint32_t b = (feb == 0) ? next : vertices[(vertex_offset - feb) & 15];
+			next += (feb == 0);
+			const uint32_t c = (fec == 0) ? next : vertices[(vertex_offset - fec) & 15];
+			next += (fec == 0);
+			write_triangle(i, a, b, c);
+			push_vertex(a, true);
+			push_vertex(b, feb == 0);
+			push_vertex(c, fec == 0);
+			push_edge(b, a);
+			push_edge(c, b);
+			push_edge(a, c);
+		} else {
+			// Three vertices with an explicit codeaux byte; 0xfe with a zero codeaux restarts the numbering.
+			const uint8_t codeaux = *data++;
+			const int fea = (codetri == 0xfe) ? 0 : 15;
+			const int feb = codeaux >> 4, fec = codeaux & 15;
+			if (codeaux == 0)
+				next = 0;
+			uint32_t a = (fea == 0) ? next++ : 0;
+			uint32_t b = (feb == 0) ? next++ : vertices[(vertex_offset - feb) & 15];
+			uint32_t c = (fec == 0) ? next++ : vertices[(vertex_offset - fec) & 15];
+			if (fea == 15)
+				last = a = decode_index(data, last);
+			if (feb == 15)
+				last = b = decode_index(data, last);
+			if (fec == 15)
+				last = c = decode_index(data, last);
+			write_triangle(i, a, b, c);
+			push_vertex(a, true);
+			push_vertex(b, feb == 0 || feb == 15);
+			push_vertex(c, fec == 0 || fec == 15);
+			push_edge(b, a);
+			push_edge(c, b);
+			push_edge(a, c);
+		}
+	}
+	return data == data_safe_end;
+}
+
+// Indices as zigzag deltas from one of two running baselines, chosen by the low bit.
+static bool
+decode_sequence(uint8_t *out, size_t count, size_t index_size, const uint8_t *buffer, size_t size)
+{
+	if ((index_size != 2 && index_size != 4) || size < 1 + count + 4)
+		return false;
+	if ((buffer[0] & 0xf0) != sequence_header || (buffer[0] & 0x0f) > 1)
+		return false;
+	const uint8_t *data = buffer + 1;
+	// Every index reads at most 5 bytes, which the 4 byte tail leaves room for.
+	const uint8_t *data_safe_end = buffer + size - 4;
+	uint32_t last[2] = {0, 0};
+	for (size_t i = 0; i < count; i++) {
+		if (data >= data_safe_end)
+			return false;
+		uint32_t v = decode_vbyte(data);
+		const uint32_t baseline = v & 1;
+		v >>= 1;
+		const uint32_t d = (v >> 1) ^ (uint32_t)-(int32_t)(v & 1);
+		last[baseline] += d;
+		write_index(out, index_size, i, last[baseline]);
+	}
+	return data == data_safe_end;
+}
+
+/*
+ * Unit vectors stored as 8 or 16 bit octahedral x, y with z holding the
+ * scale of 1. The lower hemisphere folds x and y back towards the axes, so
+ * (90, 90, 127) decodes to about (0.5, 0.5, -0.71).
+ */
+template<typename T>
+static void
+filter_octahedral(T *data, size_t count)
+{
+	const float max = (float)((1 << (sizeof(T) * 8 - 1)) - 1);
+	#pragma omp simd
+	for (size_t i = 0; i < count; i++) {
+		float x = (float)data[i * 4 + 0];
+		float y = (float)data[i * 4 + 1];
+		float z = (float)data[i * 4 + 2] - std::fabs(x) - std::fabs(y);
+		const float t = (z < 0.f) ? z : 0.f;
+		x += (x >= 0.f) ? t : -t;
+		y += (y >= 0.f) ? t : -t;
+		const float s = max / std::sqrt(x * x + y * y + z * z);
+		data[i * 4 + 0] = (T)(int)(x * s + (x >= 0.f ? 0.5f : -0.5f));
+		data[i * 4 + 1] = (T)(int)(y * s + (y >= 0.f ? 0.5f : -0.5f));
+		data[i * 4 + 2] = (T)(int)(z * s + (z >= 0.f ? 0.5f : -0.5f));
+	}
+}
+
+// Unit quaternions as three 16 bit components, the index of the dropped largest one and a scale.
+static void
+filter_quaternion(int16_t *data, size_t count)
+{
+	const float scale = 1.f / std::sqrt(2.f);
+	for (size_t i = 0; i < count; i++) {
+		const float ss = scale / (float)(data[i * 4 + 3] | 3);
+		const float x = (float)data[i * 4 + 0] * ss;
+		const float y = (float)data[i * 4 + 1] * ss;
+		const float z = (float)data[i * 4 + 2] * ss;
+		const float ww = 1.f - x * x - y * y - z * z;
+		const float w = std::sqrt(ww >= 0.f ? ww : 0.f);
+		const int qc = data[i * 4 + 3] & 3;
+		data[i * 4 + ((qc + 1) & 3)] = (int16_t)(int)(x * 32767.f + (x >= 0.f ? 0.5f : -0.5f));
+		data[i * 4 + ((qc + 2) & 3)] = (int16_t)(int)(y * 32767.f + (y >= 0.f ? 0.5f : -0.5f));
+		data[i * 4 + ((qc + 3) & 3)] = (int16_t)(int)(z * 32767.f + (z >= 0.f ? 0.5f : -0.5f));
+		data[i * 4 + ((qc + 0) & 3)] = (int16_t)(int)(w * 32767.f + 0.5f);
+	}
+}
+
+// Floats stored as a 24 bit signed mantissa and an 8 bit signed exponent.
+static void
+filter_exponential(uint32_t *data, size_t count)
+{
+	#pragma omp simd
+	for (size_t i = 0; i < count; i++) {
+		const int32_t m = (int32_t)(data[i] << 8) >> 8;
+		const int32_t e = (int32_t)data[i] >> 24;
+		float power, value;
+		const uint32_t power_bits = (uint32_t)(e + 127) << 23;
+		memcpy(&power, &power_bits, sizeof(power));
+		value = power * (float)m;
+		memcpy(&data[i], &value, sizeof(value));
+	}
+}
+
+bool
+meshopt_decode(MeshoptMode mode, MeshoptFilter filter, size_t count, size_t stride,
+	       const uint8_t *data, size_t size, uint8_t *out)
+{
+	switch (mode) {
+		case (MeshoptMode::TRIANGLES):
+			return decode_triangles(out, count, stride, data, size);
+		case (MeshoptMode::INDICES):
+			return decode_sequence(out, count, stride, data, size);
+		case (MeshoptMode::ATTRIBUTES):
+			break;
+		default:
+			return false;
+	}
+	if (!decode_vertices(out, count, stride, data, size))
+		return false;
+	switch (filter) {
+		case (MeshoptFilter::NONE):
+			return true;
+		case (MeshoptFilter::OCTAHEDRAL):
+			if (stride == 4)
+				filter_octahedral((int8_t*)out, count);
+			else if (stride == 8)
+				filter_octahedral((int16_t*)out, count);
+			else
+				return false;
+			return true;
+		case (MeshoptFilter::QUATERNION):
+			if (stride != 8)
+				return false;
+			filter_quaternion((int16_t*)out, count);
+			return true;
+		case (MeshoptFilter::EXPONENTIAL):
+			filter_exponential((uint32_t*)out, count * stride / 4);
+			return true;
+		default:
+			return false;
+	}
+}
@@ -0,0 +1,65 @@
+#include <PostProcess.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+static const float display_gamma = 1.f / 2.2f;
+static const int gamma_lut_size = 4096;
+static const size_t block_size = 1024;
+
+/*
+ * 8-bit gamma corrected values indexed by sqrt(x) instead of x: the square
+ * root spreads the entries over the dark range where x^(1/2.2) is steep, so
+ * 4096 entries stay within a small fraction of a code of the exact curve.
+ */
+static const std::array<uint8_t, gamma_lut_size> &
+gamma_lut()
+{
+	static const auto lut = [] {
+		std::array<uint8_t, gamma_lut_size> lut{};
+		for (int i = 0; i < gamma_lut_size; i++) {
+			const float s = (float)i / (float)(gamma_lut_size - 1);
+			lut[i] = (uint8_t)lrintf(255.f * powf(s, 2.f * display_gamma));
+		}
+		return lut;
+	}();
+	return lut;
+}
+
+void
+tonemap(const float *channels, uint8_t *out, size_t count, float exposure)
+{
+	const auto &lut = gamma_lut();
+	const float scale = exp2f(exposure);
+	const size_t blocks = (count + block_size - 1) / block_size;
+
+	#pragma omp parallel for schedule(static)
+	for (size_t block = 0; block < blocks; block++) {
+		const size_t first = block * block_size;
+		const size_t size = std::min(block_size, count - first);
+		int32_t index[block_size];
+		#pragma omp simd
+		for (size_t i = 0; i < size; i++) {
+			const float x = aces_tonemap(scale * channels[first + i]);
+			index[i] = (int32_t)(sqrtf(x) * (float)(gamma_lut_size - 1) + 0.5f);
+		}
+		for (size_t i = 0; i < size; i++)
+			out[first + i] = lut[std::clamp(index[i], 0, gamma_lut_size - 1)];
+	}
+}
+
+Image
+tonemap(const std::vector<Color> &pixels, int height, int width, float exposure)
+{
+	assert(pixels.size() == (size_t)height * width);
+	Image image(height, width);
+	tonemap((const float*)pixels.data(), image.raw.data(), 3 * pixels.size(), exposure);
+	return image;
+}
+
+Image
+tonemap(const Framebuffer &framebuffer, float exposure)
+{
+	return tonemap(framebuffer.resolve(), framebuffer.m_height, framebuffer.m_width, exposure);
+}
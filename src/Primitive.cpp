@@ -70,7 +70,8 @@ Primitive::intersect_ignore_transformation_plane(const Ray &ray) const
 	auto &normal = primitive_specific[0];
 	auto t = -glm::dot(ray.origin, normal)
 		 / glm::dot(ray.direction, normal);
-	if (t < 0.f || t > 1e4f)
+	// Also rejects rays parallel to the plane, whose t is infinite or NaN.
+	if (!(t >= 0.f && t < INF))
 		return std::nullopt;
 
 	Intersection intersection{};
@@ -170,6 +171,10 @@ Primitive::intersect(const Ray &ray, bool debug) const
 			break;
 		case (FigureType::PLANE):
 			intersection = intersect_ignore_transformation_plane(in_local);
+			// A bounded plane ends at the box of half extents primitive_specific[1].
+			if (intersection.has_value() &&
+			    glm::any(glm::greaterThan(glm::abs(intersection->point), primitive_specific[1])))
+				return std::nullopt;
 			break;
 		case (FigureType::BOX):
 			intersection = intersect_ignore_transformation_box(in_local, debug);
@@ -186,3 +191,47 @@ Primitive::intersect(const Ray &ray, bool debug) const
 	intersection->normal = rotate(intersection->normal, conjugate(rotation));
 	return intersection;
 }
+
+int
+Primitive::intersect_crossings(const Ray &ray, Intersection crossings[2]) const
+{
+	assert(type == FigureType::BOX || type == FigureType::ELLIPSOID);
+	auto in_local = to_local(ray, *this);
+	const auto &size = primitive_specific[0];
+	float t[2];
+	if (type == FigureType::BOX) {
+		auto v1 = (size - in_local.origin) / in_local.direction;
+		auto v2 = (-size - in_local.origin) / in_local.direction;
+		auto near = glm::min(v1, v2), far = glm::max(v1, v2);
+		t[0] = std::max({near.x, near.y, near.z});
+		t[1] = std::min({far.x, far.y, far.z});
+		if (t[0] > t[1])
+			return 0;
+	} else {
+		auto origin = in_local.origin / size, direction = in_local.direction / size;
+		if (!get_square_equation_roots(glm::dot(direction, direction), 2.f * glm::dot(origin, direction),
+					       glm::dot(origin, origin) - 1.f, t[0], t[1]))
+			return 0;
+		if (t[0] > t[1])
+			std::swap(t[0], t[1]);
+	}
+	int count = 0;
+	for (float distance : t) {
+		if (!(distance >= 0.f))
+			continue;
+		auto point = walk_along(in_local, distance);
+		glm::vec3 normal;
+		if (type == FigureType::BOX) {
+			// The face is the axis along which the point reaches furthest.
+			auto reach = glm::abs(point / size);
+			int axis = (reach.x >= reach.y && reach.x >= reach.z) ? 0 : (reach.y >= reach.z) ? 1 : 2;
+			normal = {0.f, 0.f, 0.f};
+			normal[axis] = (point[axis] >= 0.f) ? 1.f : -1.f;
+		} else {
+			normal = glm::normalize(point / (size * size));
+		}
+		crossings[count++] = {distance, walk_along(ray, distance), rotate(normal, conjugate(rotation)),
+				      t[0] < 0.f, this};
+	}
+	return count;
+}
@@ -1,196 +1,267 @@
 #include <Random.hpp>
+#include <Sampler.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <utility>
 
-Random::Random(int seed)
-	: rnd(seed),
-	uniform_(0.f, 1.f), normal_(0.f, 1.f) {}
+static inline uint32_t
+mulhilo(uint32_t a, uint32_t b, uint32_t &hi)
+{
+	uint64_t product = (uint64_t)a * b;
+	hi = (uint32_t)(product >> 32);
+	return (uint32_t)product;
+}
+
+static inline float
+to_unit_float(uint32_t x)
+{
+	return (float)(x >> 8) * (1.f / 16777216.f);
+}
+
+void
+Random::philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	uint32_t k0 = key[0], k1 = key[1];
+	for (int round = 0; round < 10; round++) {
+		uint32_t hi0, hi1;
+		uint32_t lo0 = mulhilo(0xD2511F53u, c0, hi0);
+		uint32_t lo1 = mulhilo(0xCD9E8D57u, c2, hi1);
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+Random::Random(uint32_t pixel, uint32_t sample) : key{pixel, sample} {}
 
 float
 Random::uniform(float l, float r)
 {
 	assert(l <= r);
-	return l + uniform_(rnd) * (r - l);
+	if (dimension % 4 == 0) {
+		uint32_t counter[4] = {dimension / 4, 0, 0, 0};
+		philox(counter, key, block);
+	}
+	return l + to_unit_float(block[dimension++ % 4]) * (r - l);
 }
 
 float
 Random::normal(float mu, float sigma)
 {
-	return mu + normal_(rnd) * sigma;
+	float u1 = 1.f - uniform(), u2 = uniform();
+	return mu + sqrtf(-2.f * logf(u1)) * cosf(2.f * PI * u2) * sigma;
 }
 
-Distribution::Distribution(DistributionType type) : type_(type) {}
-
+/*
+ * Fills `count` values at once. Blocks do not depend on each other, so the
+ * loop vectorizes; the next scalar draw continues after the batch.
+ */
 void
-Distribution::init_box(const Primitive* box)
+Random::uniform_batch(float *out, int count)
 {
-	primitive_ = box;
-	auto &s = primitive_->primitive_specific[0];
-	distrib_specific = 8 * (s.y * s.z + s.x * s.z + s.x * s.y);
+	uint32_t first = (dimension + 3) / 4;
+	int i = 0;
+	for (; i < count && dimension % 4 != 0; i++)
+		out[i] = uniform();
+	int blocks = (count - i) / 4;
+	#pragma omp simd
+	for (int b = 0; b < blocks; b++) {
+		uint32_t counter[4] = {first + (uint32_t)b, 0, 0, 0}, values[4];
+		philox(counter, key, values);
+		for (int c = 0; c < 4; c++)
+			out[i + 4 * b + c] = to_unit_float(values[c]);
+	}
+	i += 4 * blocks;
+	dimension += 4 * blocks;
+	for (; i < count; i++)
+		out[i] = uniform();
 }
 
-void
-Distribution::init_ellipsoid(const Primitive* ellipsoid)
+static glm::vec3
+uniform_sphere(glm::vec2 u)
 {
-	primitive_ = ellipsoid;
+	float z = 1.f - 2.f * u.x;
+	float r = sqrtf(std::max(0.f, 1.f - z * z));
+	float phi = 2.f * PI * u.y;
+	return {r * cosf(phi), r * sinf(phi), z};
 }
 
-void
-Distribution::init_triangle(const Primitive* triangle)
+static inline glm::vec3
+orthogonalized(glm::vec3 v, glm::vec3 w)
 {
-	primitive_ = triangle;
-	const auto &a = primitive_->primitive_specific[2];
-	const auto &b = primitive_->primitive_specific[0] - a;
-	const auto &c = primitive_->primitive_specific[1] - a;
-	const auto normal = glm::cross(b, c);
-	distrib_specific = 1.f / (0.5f * glm::length(normal));
+	return glm::normalize(v - glm::dot(v, w) * w);
 }
 
-void
-Distribution::init_mixed(std::vector<Distribution> &&distributions)
+static float
+ellipsoid_area(glm::vec3 r)
 {
-	distributions_ = std::move(distributions);
+	// Knud Thomsen's approximation, within ~1% for any axes.
+	const float p = 1.6075f;
+	float ab = powf(r.x * r.y, p), ac = powf(r.x * r.z, p), bc = powf(r.y * r.z, p);
+	return 4.f * PI * powf((ab + ac + bc) / 3.f, 1.f / p);
 }
 
-void
-Distribution::init_mixed_on_primitives(const std::vector<Distribution> &distributions)
+Emitter
+Emitter::make(const Primitive *primitive)
 {
-	std::vector<const Primitive*> primitives;
-	primitives.reserve(distributions.size());
-	for(auto &distribution : distributions)
-		primitives.push_back(distribution.primitive_);
-	bvh_ = BVH(primitives);
-	distributions_.reserve(distributions.size());
-	for (auto &primitive : bvh_.primitives) {
-		switch (primitive->type) {
-			case (FigureType::BOX): {
-				Distribution distribution(DistributionType::BOX);
-				distribution.init_box(primitive);
-				distributions_.push_back(std::move(distribution));
-				break;
-			}
-			case (FigureType::ELLIPSOID): {
-				Distribution distribution(DistributionType::ELLIPSOID);
-				distribution.init_ellipsoid(primitive);
-				distributions_.push_back(std::move(distribution));
-				break;
-			}
-			case (FigureType::TRIANGLE): {
-				Distribution distribution(DistributionType::TRIANGLE);
-				distribution.init_triangle(primitive);
-				distributions_.push_back(std::move(distribution));
-				break;
-			}
-			default:
-				unreachable();
+	Emitter emitter{};
+	emitter.type = primitive->type;
+	emitter.primitive = primitive;
+	const auto &s = primitive->primitive_specific[0];
+	switch (primitive->type) {
+		case (FigureType::BOX):
+			emitter.distrib_specific = 8 * (s.y * s.z + s.x * s.z + s.x * s.y);
+			emitter.area = emitter.distrib_specific;
+			break;
+		case (FigureType::ELLIPSOID):
+			emitter.area = ellipsoid_area(s);
+			break;
+		case (FigureType::TRIANGLE): {
+			for (int i = 0; i < 3; i++)
+				emitter.vertices[i] = primitive->position +
+						      rotate(primitive->primitive_specific[i], conjugate(primitive->rotation));
+			emitter.normal = glm::cross(emitter.vertices[0] - emitter.vertices[2],
+						    emitter.vertices[1] - emitter.vertices[2]);
+			emitter.area = 0.5f * glm::length(emitter.normal);
+			emitter.distrib_specific = 1.f / emitter.area;
+			emitter.normal = glm::normalize(emitter.normal);
+			break;
 		}
+		default:
+			unreachable();
 	}
+	return emitter;
 }
 
-glm::vec3
-Distribution::sample_cosine(Random &rnd_, glm::vec3 n_x) const
+DirectionSample
+Emitter::sample_box(Sampler &sampler, glm::vec3 x) const
 {
-	float x_ = rnd_.normal(), y_ = rnd_.normal(), z_ = rnd_.normal();
-	auto w = glm::normalize(glm::vec3(x_, y_, z_));
-	w = w + n_x;
-	auto len = glm::length(w);
-	if (std::isnan(len) || len <= EPS5 || glm::dot(w, n_x) <= EPS5)
-		return n_x;
-	return glm::normalize(w);
-}
-
-glm::vec3
-Distribution::sample_box(Random &rnd_, glm::vec3 x) const
-{
-	auto &s = primitive_->primitive_specific[0];
+	auto &s = primitive->primitive_specific[0];
 	glm::vec3 weight = {s.y * s.z, s.x * s.z, s.x * s.y};
-	while (true) {
-		float u = rnd_.uniform(0.f, weight.x + weight.y + weight.z);
-		float sign = (rnd_.uniform() > 0.5f) ? 1.f : -1.f;
-		glm::vec3 y;
-		if (u < weight.x)
-			y = glm::vec3(sign * s.x, rnd_.uniform(-s.y, s.y), rnd_.uniform(-s.z, s.z));
-		else if (u < weight.x + weight.y)
-			y = glm::vec3(rnd_.uniform(-s.x, s.x), sign * s.y, rnd_.uniform(-s.z, s.z));
-		else
-			y = glm::vec3(rnd_.uniform(-s.x, s.x), rnd_.uniform(-s.y, s.y), sign * s.z);
-		y = rotate(y, conjugate(primitive_->rotation)) + primitive_->position;
-		auto w = glm::normalize(y - x);
-		if (primitive_->intersect(Ray{w, x}).has_value())
-			return w;
-	}
+	float u = sampler.get1d() * (weight.x + weight.y + weight.z);
+	float sign = (sampler.get1d() > 0.5f) ? 1.f : -1.f;
+	auto v = 2.f * sampler.get2d() - 1.f;
+	glm::vec3 y;
+	if (u < weight.x)
+		y = glm::vec3(sign * s.x, v.x * s.y, v.y * s.z);
+	else if (u < weight.x + weight.y)
+		y = glm::vec3(v.x * s.x, sign * s.y, v.y * s.z);
+	else
+		y = glm::vec3(v.x * s.x, v.y * s.y, sign * s.z);
+	y = rotate(y, conjugate(primitive->rotation)) + primitive->position;
+	auto w = glm::normalize(y - x);
+	return {w, pdf_crossings(x, w), primitive, glm::length(y - x)};
 }
 
-glm::vec3
-Distribution::sample_ellipsoid(Random &rnd_, glm::vec3 x) const
+DirectionSample
+Emitter::sample_ellipsoid(Sampler &sampler, glm::vec3 x) const
 {
-	auto r = primitive_->primitive_specific[0];
-	while (true) {
-		float x_ = rnd_.normal(), y_ = rnd_.normal(), z_ = rnd_.normal();
-		auto y = r * glm::normalize(glm::vec3(x_, y_, z_));
-		y = rotate(y, conjugate(primitive_->rotation)) + primitive_->position;
-		auto w = glm::normalize(y - x);
-		if (primitive_->intersect(Ray{w, x}).has_value())
-			return w;
-	}
+	auto y = primitive->primitive_specific[0] * uniform_sphere(sampler.get2d());
+	y = rotate(y, conjugate(primitive->rotation)) + primitive->position;
+	auto w = glm::normalize(y - x);
+	return {w, pdf_crossings(x, w), primitive, glm::length(y - x)};
 }
 
-glm::vec3
-Distribution::sample_triangle(Random &rnd_, glm::vec3 x) const
+/*
+ * Solid angle subtended by the triangle at x (Van Oosterom and Strackee),
+ * or zero when it is too small or too large to be sampled stably. The
+ * choice depends on x only, so sample() and pdf() always agree on it.
+ */
+float
+Emitter::triangle_solid_angle(glm::vec3 x) const
 {
-	while (true) {
-		const auto &a = primitive_->primitive_specific[2];
-		const auto &b = primitive_->primitive_specific[0] - a;
-		const auto &c = primitive_->primitive_specific[1] - a;
-		float u = rnd_.uniform(), v = rnd_.uniform();
-		if (u + v > 1.f) {
-			u = 1.f - u;
-			v = 1.f - v;
-		}
-		auto y = primitive_->position + rotate(a + u * b + v * c, conjugate(primitive_->rotation));
-		auto w = glm::normalize(y - x);
-		if (primitive_->intersect(Ray{w, x}).has_value())
-			return w;
-		return w;
-	}
+	auto a = glm::normalize(vertices[0] - x);
+	auto b = glm::normalize(vertices[1] - x);
+	auto c = glm::normalize(vertices[2] - x);
+	float numerator = std::abs(glm::dot(a, glm::cross(b, c)));
+	float denominator = 1.f + glm::dot(a, b) + glm::dot(b, c) + glm::dot(c, a);
+	float solid_angle = 2.f * atan2f(numerator, denominator);
+	if (std::isnan(solid_angle) || solid_angle < min_spherical_sample_area || solid_angle > max_spherical_sample_area)
+		return 0.f;
+	return solid_angle;
 }
 
+// Arvo, "Stratified Sampling of Spherical Triangles".
 glm::vec3
-Distribution::sample_mixed(Random &rnd_, glm::vec3 x, glm::vec3 n_x) const
+Emitter::sample_spherical_triangle(glm::vec2 u, glm::vec3 x) const
 {
-	auto i = (int)(rnd_.uniform(0, 1.f - EPS5) * (float)distributions_.size());
-	return distributions_[i].sample(rnd_, x, n_x);
+	auto a = glm::normalize(vertices[0] - x);
+	auto b = glm::normalize(vertices[1] - x);
+	auto c = glm::normalize(vertices[2] - x);
+	auto n_ab = glm::normalize(glm::cross(a, b));
+	auto n_bc = glm::normalize(glm::cross(b, c));
+	auto n_ca = glm::normalize(glm::cross(c, a));
+	float alpha = acosf(glm::clamp(glm::dot(n_ab, -n_ca), -1.f, 1.f));
+	float beta = acosf(glm::clamp(glm::dot(n_bc, -n_ab), -1.f, 1.f));
+	float gamma = acosf(glm::clamp(glm::dot(n_ca, -n_bc), -1.f, 1.f));
+
+	float area_pi = glm::mix(PI, alpha + beta + gamma, u.x);
+	float cos_alpha = cosf(alpha), sin_alpha = sinf(alpha);
+	float sin_phi = sinf(area_pi) * cos_alpha - cosf(area_pi) * sin_alpha;
+	float cos_phi = cosf(area_pi) * cos_alpha + sinf(area_pi) * sin_alpha;
+	float k1 = cos_phi + cos_alpha;
+	float k2 = sin_phi - sin_alpha * glm::dot(a, b);
+	float cos_bp = (k2 + (k2 * cos_phi - k1 * sin_phi) * cos_alpha) / ((k2 * sin_phi + k1 * cos_phi) * sin_alpha);
+	cos_bp = glm::clamp(cos_bp, -1.f, 1.f);
+	float sin_bp = sqrtf(std::max(0.f, 1.f - cos_bp * cos_bp));
+	auto c_p = cos_bp * a + sin_bp * orthogonalized(c, a);
+
+	float cos_theta = 1.f - u.y * (1.f - glm::dot(c_p, b));
+	float sin_theta = sqrtf(std::max(0.f, 1.f - cos_theta * cos_theta));
+	return cos_theta * b + sin_theta * orthogonalized(c_p, b);
 }
 
-glm::vec3
-Distribution::sample_mixed_on_primitives(Random &rnd_, glm::vec3 x, glm::vec3 n_x) const
+DirectionSample
+Emitter::sample_triangle(Sampler &sampler, glm::vec3 x) const
 {
-	return sample_mixed(rnd_, x, n_x);
+	auto uv = sampler.get2d();
+	float solid_angle = triangle_solid_angle(x);
+	if (solid_angle > 0.f) {
+		auto w = sample_spherical_triangle(uv, x);
+		if (!std::isnan(w.x) && !std::isnan(w.y) && !std::isnan(w.z)) {
+			// The direction is known to cross the triangle, only the plane distance is left.
+			float distance = glm::dot(vertices[2] - x, normal) / glm::dot(w, normal);
+			return {w, 1.f / solid_angle, primitive, std::isnan(distance) ? INF : distance};
+		}
+	}
+	float u = uv.x, v = uv.y;
+	if (u + v > 1.f) {
+		u = 1.f - u;
+		v = 1.f - v;
+	}
+	auto y = vertices[2] + u * (vertices[0] - vertices[2]) + v * (vertices[1] - vertices[2]);
+	// A point on the triangle lies inside its solid angle, so a failed spherical sample keeps the pdf pdf() gives.
+	float p = (solid_angle > 0.f) ? 1.f / solid_angle : pdf1_triangle(x, y, normal);
+	return {glm::normalize(y - x), p, primitive, glm::length(y - x)};
 }
 
-glm::vec3
-Distribution::sample(Random &rnd_, glm::vec3 x, glm::vec3 n_x) const
+DirectionSample
+Emitter::sample(Sampler &sampler, glm::vec3 x) const
 {
-	switch (type_) {
-		case (DistributionType::COSINE):
-			return sample_cosine(rnd_, n_x);
-		case (DistributionType::BOX):
-			return sample_box(rnd_, x);
-		case (DistributionType::ELLIPSOID):
-			return sample_ellipsoid(rnd_, x);
-		case (DistributionType::TRIANGLE):
-			return sample_triangle(rnd_, x);
-		case (DistributionType::MIXED):
-			return sample_mixed(rnd_, x, n_x);
-		case (DistributionType::MIXED_ON_PRIMITIVES):
-			return sample_mixed_on_primitives(rnd_, x, n_x);
+	switch (type) {
+		case (FigureType::BOX):
+			return sample_box(sampler, x);
+		case (FigureType::ELLIPSOID):
+			return sample_ellipsoid(sampler, x);
+		case (FigureType::TRIANGLE):
+			return sample_triangle(sampler, x);
 		default:
 			unreachable();
 	}
+	return {};
 }
 
 float
-Distribution::pdf1_box(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
+Emitter::pdf1_box(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
 {
 	auto w = y - x;
 	auto t = glm::dot(w, w);
@@ -201,10 +272,10 @@ Distribution::pdf1_box(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
 }
 
 float
-Distribution::pdf1_ellipsoid(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
+Emitter::pdf1_ellipsoid(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
 {
-	auto r = primitive_->primitive_specific[0];
-	auto n = rotate(y - primitive_->position, primitive_->rotation) / r;
+	auto r = primitive->primitive_specific[0];
+	auto n = rotate(y - primitive->position, primitive->rotation) / r;
 	auto p = 1.f / (4.f * PI * glm::length(glm::vec3(n.x * r.y * r.z, r.x * n.y * r.z, r.x * r.y * n.z)));
 	auto w = y - x;
 	auto t = glm::dot(w, w);
@@ -215,7 +286,7 @@ Distribution::pdf1_ellipsoid(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
 }
 
 float
-Distribution::pdf1_triangle(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
+Emitter::pdf1_triangle(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
 {
 	auto w = y - x;
 	auto t = glm::dot(w, w);
@@ -226,96 +297,149 @@ Distribution::pdf1_triangle(glm::vec3 x, glm::vec3 y, glm::vec3 n_y) const
 }
 
 float
-Distribution::pdf_cosine(glm::vec3 n_x, glm::vec3 w) const
+Emitter::pdf_crossings(glm::vec3 x, glm::vec3 w) const
 {
-	float res = std::max(0.f, glm::dot(w, n_x) / PI);
-	return res;
+	Intersection crossings[2];
+	int count = primitive->intersect_crossings({w, x}, crossings);
+	float p = 0.f;
+	for (int i = 0; i < count; i++) {
+		if (crossings[i].distance < EPS5)
+			return INF;
+		const auto &y = crossings[i].point;
+		const auto &n_y = crossings[i].normal;
+		p += (type == FigureType::BOX) ? pdf1_box(x, y, n_y) : pdf1_ellipsoid(x, y, n_y);
+	}
+	return p;
 }
 
 float
-Distribution::pdf1_primitive(glm::vec3 x, glm::vec3 w, glm::vec3 n_y) const
+Emitter::pdf(glm::vec3 x, glm::vec3 w) const
 {
-	switch (type_) {
-		case (DistributionType::BOX):
-			return pdf1_box(x, w, n_y);
-		case (DistributionType::ELLIPSOID):
-			return pdf1_ellipsoid(x, w, n_y);
+	switch (type) {
+		case (FigureType::BOX):
+		case (FigureType::ELLIPSOID):
+			return pdf_crossings(x, w);
+		case (FigureType::TRIANGLE): {
+			auto intersection = primitive->intersect({w, x});
+			if (!intersection.has_value())
+				return 0.f;
+			if (intersection->distance < EPS5)
+				return INF;
+			float solid_angle = triangle_solid_angle(x);
+			if (solid_angle > 0.f)
+				return 1.f / solid_angle;
+			return pdf1_triangle(x, intersection->point, normal);
+		}
 		default:
 			unreachable();
 	}
+	return 0.f;
 }
 
-float
-Distribution::pdf_mixed(glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const
+/*
+ * Emitters are stored in the order of the emitter BVH leaves, with a
+ * cumulative table of selection probabilities proportional to the
+ * emitted power.
+ */
+Distribution::Distribution(const std::vector<const Primitive*> &emitters)
 {
-	float p = 0;
-	for (const auto &distrib : distributions_)
-		p += distrib.pdf(x, n_x, w);
-	return p / (float)distributions_.size();
+	if (emitters.empty())
+		return;
+	bvh_ = BVH(emitters);
+	emitters_.reserve(bvh_.primitives.size());
+	cdf_.reserve(bvh_.primitives.size());
+	float total = 0.f;
+	for (auto &primitive : bvh_.primitives) {
+		auto emitter = Emitter::make(primitive);
+		const auto &e = primitive->material.emission;
+		emitter.selection_pdf = (0.2126f * e.x + 0.7152f * e.y + 0.0722f * e.z) * emitter.area;
+		total += emitter.selection_pdf;
+		cdf_.push_back(total);
+		emitters_.push_back(emitter);
+	}
+	for (size_t i = 0; i < emitters_.size(); i++) {
+		emitters_[i].selection_pdf /= total;
+		cdf_[i] /= total;
+	}
+	cosine_weight = 0.5f;
+}
+
+DirectionSample
+Distribution::sample_cosine(Sampler &sampler, glm::vec3 n_x)
+{
+	// Malley's method: uniform disk sample lifted onto the hemisphere around n_x.
+	auto u = sampler.get2d();
+	float r = sqrtf(u.x);
+	float phi = 2.f * PI * u.y;
+	glm::vec3 t, b;
+	orthonormal_basis(n_x, t, b);
+	auto w = r * cosf(phi) * t + r * sinf(phi) * b + sqrtf(std::max(0.f, 1.f - u.x)) * n_x;
+	return {w, pdf_cosine(n_x, w)};
 }
 
 float
-Distribution::pdf_sum_bvh(uint32_t current_id, glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const
+Distribution::pdf_cosine(glm::vec3 n_x, glm::vec3 w)
 {
-	Ray ray = {w, x};
-	const Node &current = bvh_.nodes[current_id];
-	auto intersection = current.aabb.intersect(ray);
-	if (!intersection.has_value())
-		return 0.f;
-	if (current.left_child == -1 && current.right_child == -1) {
-		float pdf_sum = 0;
-		for (int i = 0; i < current.primitive_count; i++)
-			pdf_sum += distributions_[current.first_primitive_id + i].pdf(x, n_x, w);
-		return pdf_sum;
+	return std::max(0.f, glm::dot(w, n_x) / PI);
+}
+
+/*
+ * The chosen component already knows its own pdf; only the remaining
+ * components are evaluated along the sampled direction.
+ */
+DirectionSample
+Distribution::sample(Sampler &sampler, glm::vec3 x, glm::vec3 n_x) const
+{
+	if (sampler.get1d() < cosine_weight) {
+		auto result = sample_cosine(sampler, n_x);
+		result.pdf = cosine_weight * result.pdf + (1.f - cosine_weight) * pdf_emitters(x, result.w);
+		return result;
 	}
-	return pdf_sum_bvh(current.left_child, x, n_x, w) +
-		pdf_sum_bvh(current.right_child, x, n_x, w);
+	auto i = (int)(std::lower_bound(cdf_.begin(), cdf_.end(), sampler.get1d()) - cdf_.begin());
+	i = std::min(i, (int)emitters_.size() - 1);
+	auto result = emitters_[i].sample(sampler, x);
+	float emitters_pdf = emitters_[i].selection_pdf * result.pdf + pdf_emitters(x, result.w, i);
+	result.pdf = cosine_weight * pdf_cosine(n_x, result.w) + (1.f - cosine_weight) * emitters_pdf;
+	return result;
 }
 
+// Walks the emitter BVH with an explicit stack, summing the pdfs of the emitters crossed by w.
 float
-Distribution::pdf_mixed_on_primitives(glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const
+Distribution::pdf_emitters(glm::vec3 x, glm::vec3 w, int skip) const
 {
-	return pdf_sum_bvh(bvh_.root, x, n_x, w) / (float)distributions_.size();
+	if (emitters_.empty())
+		return 0.f;
+	Ray ray = {w, x};
+	// The builder does not cap the depth, so degenerate emitter sets get a stack sized to their tree.
+	int local_stack[max_bvh_depth];
+	std::vector<int> deep_stack;
+	int *stack = local_stack;
+	if (bvh_.depth + 1 > max_bvh_depth) {
+		deep_stack.resize(bvh_.depth + 1);
+		stack = deep_stack.data();
+	}
+	int stack_size = 0;
+	stack[stack_size++] = bvh_.root;
+	float pdf_sum = 0.f;
+	while (stack_size > 0) {
+		const Node &current = bvh_.nodes[stack[--stack_size]];
+		if (!current.aabb.intersect(ray).has_value())
+			continue;
+		if (current.left_child == -1 && current.right_child == -1) {
+			for (int i = current.first_primitive_id; i < current.first_primitive_id + current.primitive_count; i++)
+				if (i != skip)
+					pdf_sum += emitters_[i].selection_pdf * emitters_[i].pdf(x, w);
+			continue;
+		}
+		assert(stack_size + 2 <= std::max(bvh_.depth + 1, max_bvh_depth));
+		stack[stack_size++] = current.left_child;
+		stack[stack_size++] = current.right_child;
+	}
+	return pdf_sum;
 }
 
 float
 Distribution::pdf(glm::vec3 x, glm::vec3 n_x, glm::vec3 w) const
 {
-	switch (type_) {
-		case (DistributionType::COSINE):
-			return pdf_cosine(n_x, w);
-		case (DistributionType::BOX):
-		case (DistributionType::ELLIPSOID): {
-			auto origin = x;
-			float p = 0.f;
-			for (int i = 0; i < 2; i++) {
-				auto intersection = primitive_->intersect({w, origin});
-				if (!intersection.has_value())
-					return p;
-				if (intersection->distance < EPS5)
-					return INF;
-				const auto &y = intersection.value().point;
-				const auto &n_y = intersection.value().normal;
-				p += pdf1_primitive(x, y, n_y);
-				origin = intersection->point + w * EPS4;
-			}
-			return p;
-		}
-		case (DistributionType::TRIANGLE): {
-			auto intersection = primitive_->intersect({w, x});
-			if (!intersection.has_value())
-				return 0.f;
-			if (intersection->distance < EPS5)
-				return INF;
-			auto y = intersection.value().point;
-			auto n_y = intersection.value().normal;
-			return pdf1_triangle(x, y, n_y);
-		}
-		case (DistributionType::MIXED):
-			return pdf_mixed(x, n_x, w);
-		case (DistributionType::MIXED_ON_PRIMITIVES):
-			return pdf_mixed_on_primitives(x, n_x, w);
-		default:
-			unreachable();
-	}
+	return cosine_weight * pdf_cosine(n_x, w) + (1.f - cosine_weight) * pdf_emitters(x, w);
 }
@@ -0,0 +1,163 @@
+#include <Sampler.hpp>
+
+#include <utils.hpp>
+
+#include <cmath>
+
+static inline uint32_t
+mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline uint32_t
+hash_combine(uint32_t seed, uint32_t v)
+{
+	return mix(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+static inline float
+to_unit_float(uint32_t x)
+{
+	return (float)(x >> 8) * (1.f / 16777216.f);
+}
+
+static inline uint32_t
+reverse_bits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// First two Sobol dimensions: van der Corput and the (x + 1) polynomial.
+static inline uint32_t
+sobol(uint32_t index, int dimension)
+{
+	if (dimension == 0)
+		return reverse_bits(index);
+	uint32_t result = 0;
+	for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+		if (index & 1u)
+			result ^= v;
+	return result;
+}
+
+// Hash-based Owen scrambling (Burley, "Practical Hash-based Owen Scrambling").
+static inline uint32_t
+nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+	x = reverse_bits(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return reverse_bits(x);
+}
+
+// Random permutation of [0, l) (Kensler, "Correlated Multi-Jittered Sampling").
+static uint32_t
+permute(uint32_t i, uint32_t l, uint32_t p)
+{
+	uint32_t w = l - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do {
+		i ^= p;
+		i *= 0xe170893du;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8;
+		i *= 0x0929eb3fu;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1u | p >> 27;
+		i *= 0x6935fa69u;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303u;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3u;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3dfu;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= l);
+	return (i + p) % l;
+}
+
+Sampler::Sampler(SamplerType type, uint32_t samples_per_pixel)
+	: type_(type), samples_per_pixel_(std::max(1u, samples_per_pixel)), rnd_(0, 0) {}
+
+void
+Sampler::start_sample(uint32_t pixel, uint32_t sample)
+{
+	pixel_ = pixel;
+	sample_ = sample;
+	dimension_ = 0;
+	rnd_ = Random(pixel, sample);
+}
+
+float
+Sampler::get1d()
+{
+	uint32_t seed = hash_combine(mix(pixel_), dimension_++);
+	switch (type_) {
+		case (SamplerType::INDEPENDENT):
+			return rnd_.uniform();
+		case (SamplerType::STRATIFIED): {
+			// Passes beyond samples_per_pixel_ start a freshly permuted set of strata.
+			seed = hash_combine(seed, sample_ / samples_per_pixel_);
+			auto stratum = permute(sample_ % samples_per_pixel_, samples_per_pixel_, seed);
+			return ((float)stratum + rnd_.uniform()) / (float)samples_per_pixel_;
+		}
+		case (SamplerType::SOBOL): {
+			auto index = nested_uniform_scramble(sample_, seed);
+			return to_unit_float(nested_uniform_scramble(sobol(index, 0), hash_combine(seed, 0)));
+		}
+		default:
+			unreachable();
+	}
+	return 0.f;
+}
+
+glm::vec2
+Sampler::get2d()
+{
+	uint32_t seed = hash_combine(mix(pixel_), dimension_++);
+	switch (type_) {
+		case (SamplerType::INDEPENDENT): {
+			float u = rnd_.uniform();
+			return {u, rnd_.uniform()};
+		}
+		case (SamplerType::STRATIFIED): {
+			auto nx = std::max(1u, (uint32_t)sqrtf((float)samples_per_pixel_));
+			auto ny = (samples_per_pixel_ + nx - 1) / nx;
+			seed = hash_combine(seed, sample_ / samples_per_pixel_);
+			auto stratum = permute(sample_ % samples_per_pixel_, nx * ny, seed);
+			float u = ((float)(stratum % nx) + rnd_.uniform()) / (float)nx;
+			return {u, ((float)(stratum / nx) + rnd_.uniform()) / (float)ny};
+		}
+		case (SamplerType::SOBOL): {
+			auto index = nested_uniform_scramble(sample_, seed);
+			return {
+				to_unit_float(nested_uniform_scramble(sobol(index, 0), hash_combine(seed, 0))),
+				to_unit_float(nested_uniform_scramble(sobol(index, 1), hash_combine(seed, 1)))
+			};
+		}
+		default:
+			unreachable();
+	}
+	return {0.f, 0.f};
+}
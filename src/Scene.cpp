@@ -1,142 +1,430 @@
 #include <Scene.hpp>
+#include <Accessor.hpp>
 #include <Gltf.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <iostream>
 #include <filesystem>
 #include <memory>
 
+#include <unistd.h>
+
 Distribution
 build_distribution(const Scene &scene)
 {
-	std::vector<Distribution> primitive_distributions;
-	for (const auto &primitive : scene.primitives) {
-		if (primitive.material.emission.x > 0.f || primitive.material.emission.y > 0.f || primitive.material.emission.z > 0.f) {
-			switch (primitive.type) {
-				case (FigureType::BOX): {
-					Distribution box(DistributionType::BOX);
-					box.init_box(&primitive);
-					primitive_distributions.push_back(std::move(box));
-					break;
-				}
-				case (FigureType::ELLIPSOID): {
-					Distribution ellipsoid(DistributionType::ELLIPSOID);
-					ellipsoid.init_ellipsoid(&primitive);
-					primitive_distributions.push_back(std::move(ellipsoid));
-					break;
-				}
-				case (FigureType::TRIANGLE): {
-					Distribution triangle(DistributionType::TRIANGLE);
-					triangle.init_triangle(&primitive);
-					primitive_distributions.push_back(std::move(triangle));
-					break;
-				}
-				default:
-					unreachable();
-			}
-		}
-	}
-	std::vector<Distribution> distributions;
-	{
-		Distribution cosine(DistributionType::COSINE);
-		distributions.push_back(std::move(cosine));
-	}
-	if (!primitive_distributions.empty()) {
-		Distribution mixed(DistributionType::MIXED_ON_PRIMITIVES);
-		mixed.init_mixed_on_primitives(primitive_distributions);
-		distributions.push_back(std::move(mixed));
-	}
-	{
-		Distribution mixed(DistributionType::MIXED);
-		mixed.init_mixed(std::move(distributions));
-		return mixed;
+	std::vector<const Primitive*> emitters;
+	for (const auto &primitive : scene.primitives)
+		if (primitive.type != FigureType::PLANE &&
+		    (primitive.material.emission.x > 0.f || primitive.material.emission.y > 0.f || primitive.material.emission.z > 0.f))
+			emitters.push_back(&primitive);
+	return Distribution(emitters);
+}
+
+static void
+build_bvh(Scene &scene)
+{
+	std::vector<const Primitive*> primitives_;
+	primitives_.reserve(scene.primitives.size());
+	for(auto &primitive : scene.primitives)
+		primitives_.push_back(&primitive);
+	scene.bvh = BVH(primitives_);
+	scene.bvh_built_cost = scene.bvh.sah_cost();
+	scene.primitive_leaf.assign(scene.primitives.size(), -1);
+	for (int id = 0; id < (int)scene.bvh.nodes.size(); id++) {
+		const auto &node = scene.bvh.nodes[id];
+		if (node.left_child != -1)
+			continue;
+		for (int i = 0; i < node.primitive_count; i++)
+			scene.primitive_leaf[scene.bvh.primitives[node.first_primitive_id + i] - scene.primitives.data()] = id;
 	}
 }
 
+static glm::vec4
+plane_equation(const Primitive &plane)
+{
+	auto normal = glm::normalize(rotate(plane.primitive_specific[0], conjugate(plane.rotation)));
+	return {normal, -glm::dot(normal, plane.position)};
+}
+
 void
 Scene::init() {
 	distribution = build_distribution(*this);
-	std::vector<const Primitive*> primitives_;
-	primitives_.reserve(primitives.size());
-	for(auto &primitive : primitives)
-		primitives_.push_back(&primitive);
-	bvh = BVH(primitives_);
+	build_bvh(*this);
+	plane_equations.clear();
+	plane_clipped.clear();
+	for (const auto &plane : planes) {
+		plane_equations.push_back(plane_equation(plane));
+		plane_clipped.push_back(glm::any(glm::lessThan(plane.primitive_specific[1], glm::vec3(INF))));
+	}
 }
 
-void load_buffers(std::string_view gltf_file_name, const rapidjson::Document &gltfScene, Scene &scene) {
-	const auto &buffer_specs = gltfScene["buffers"].GetArray();
-	for (const auto &buffer_spec : buffer_specs) {
-		size_t buffer_len = buffer_spec["byteLength"].GetUint();
-		GltfBuffer buf(buffer_len);
-		const auto gltf_file_path = std::filesystem::path(gltf_file_name);
-		const auto buffer_file_path = gltf_file_path.parent_path().append(buffer_spec["uri"].GetString());
-		std::ifstream bufferStream(buffer_file_path, std::ios::binary);
-		bufferStream.read(buf.data(), (std::streamsize)buffer_len);
-		scene.buffers.push_back(std::move(buf));
+static Camera
+camera_from_node(const GltfNode &node, Camera camera)
+{
+	camera.position = node.total_transition.transform({0, 0, 0});
+	camera.up = node.total_transition.transform({0, 1, 0}) - camera.position;
+	camera.right = node.total_transition.transform({1, 0, 0}) - camera.position;
+	camera.forward = node.total_transition.transform({0, 0, -1}) - camera.position;
+	return camera;
+}
+
+/*
+ * Places an analytic shape with its node's world transform. Primitives only
+ * carry a rotation and a position, so the transform's scale goes into the
+ * extents of the shape or the direction of the plane normal, which is exact
+ * unless the node is sheared by a parent's non-uniform scale. Returns false
+ * and leaves the primitive alone when the transform collapses an axis.
+ */
+static bool
+pose_shape(const GltfShape &shape, const Transform &transform, Primitive &primitive)
+{
+	const auto origin = transform.transform({0, 0, 0});
+	glm::mat3 axes;
+	glm::vec3 scale(1.f), normal = shape.normal;
+	for (int i = 0; i < 3; i++) {
+		glm::vec3 axis = {0, 0, 0};
+		axis[i] = 1.f;
+		axes[i] = transform.transform(axis) - origin;
+		scale[i] = glm::length(axes[i]);
+		if (!(scale[i] > 0.f))
+			return false;
+		axes[i] /= scale[i];
+	}
+	// A mirroring transform leaves the symmetric shapes alone but flips the plane normal.
+	if (glm::determinant(axes) < 0.f) {
+		axes[0] = -axes[0];
+		normal.x = -normal.x;
 	}
+	primitive.position = origin;
+	primitive.rotation = glm::quat_cast(axes);
+	if (shape.type != GltfShapeType::PLANE) {
+		primitive.primitive_specific[0] = shape.size * scale;
+		return true;
+	}
+	primitive.primitive_specific[0] = glm::normalize(normal / scale);
+	for (int i = 0; i < 3; i++)
+		primitive.primitive_specific[1][i] = (shape.extent[i] > 0.f) ? shape.extent[i] * scale[i] : INF;
+	return true;
 }
 
-void load_buffer_views(const rapidjson::Document &gltfScene, Scene &scene) {
-	const auto &buffer_view_specs = gltfScene["bufferViews"].GetArray();
-	for (const auto &buffer_view_spec : buffer_view_specs) {
-		scene.bufferViews.push_back(GltfBufferView{
-			buffer_view_spec["buffer"].GetUint(),
-			buffer_view_spec["byteLength"].GetUint(),
-			buffer_view_spec["byteOffset"].GetUint(),
-		});
+static glm::vec4
+sample_channel(const GltfAnimationChannel &channel, float time)
+{
+	const auto &times = channel.times;
+	const bool cubic = channel.interpolation == GltfInterpolation::CUBICSPLINE;
+	auto value = [&](size_t key) { return channel.values[cubic ? 3 * key + 1 : key]; };
+	if (times.size() == 1 || time <= times.front())
+		return value(0);
+	if (time >= times.back())
+		return value(times.size() - 1);
+	size_t next = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+	size_t key = next - 1;
+	float dt = times[next] - times[key];
+	float s = (time - times[key]) / dt;
+	switch (channel.interpolation) {
+		case (GltfInterpolation::STEP):
+			return value(key);
+		case (GltfInterpolation::LINEAR): {
+			if (channel.path != GltfAnimationPath::ROTATION)
+				return glm::mix(value(key), value(next), s);
+			auto a = value(key), b = value(next);
+			auto q = glm::slerp(glm::quat(a.w, a.x, a.y, a.z), glm::quat(b.w, b.x, b.y, b.z), s);
+			return {q.x, q.y, q.z, q.w};
+		}
+		case (GltfInterpolation::CUBICSPLINE): {
+			// Hermite spline between the values, with the out- and in-tangents scaled by the key interval.
+			float s2 = s * s, s3 = s2 * s;
+			auto v = (2.f * s3 - 3.f * s2 + 1.f) * value(key) +
+				 (s3 - 2.f * s2 + s) * dt * channel.values[3 * key + 2] +
+				 (-2.f * s3 + 3.f * s2) * value(next) +
+				 (s3 - s2) * dt * channel.values[3 * next];
+			return (channel.path == GltfAnimationPath::ROTATION) ? glm::normalize(v) : v;
+		}
+		default:
+			unreachable();
 	}
+	return value(key);
+}
+
+// Recomputes the world transform of a dynamic node and everything below it.
+static void
+update_node(Scene &scene, size_t id)
+{
+	auto &node = scene.nodes[id];
+	node.total_transition = node.parent_node.has_value() ?
+		scene.nodes[node.parent_node.value()].total_transition.prod(node.transition.value()) :
+		node.transition.value();
+	for (auto child : node.children)
+		update_node(scene, child);
 }
 
-void load_nodes(const rapidjson::Document &gltfScene, Scene &scene) {
-	const auto &node_specs = gltfScene["nodes"].GetArray();
-	for (const auto &node_spec : node_specs) {
-		GltfNode node;
-		if (node_spec.HasMember("mesh"))
-			node.mesh = node_spec["mesh"].GetUint();
-		if (node_spec.HasMember("camera"))
-			node.camera = node_spec["camera"].GetUint();
-		if (node_spec.HasMember("rotation")) {
-			const auto &rotation = node_spec["rotation"].GetArray();
-			node.rotation = {
-				rotation[3].GetFloat(),
-				rotation[0].GetFloat(),
-				rotation[1].GetFloat(),
-				rotation[2].GetFloat()
-			};
+/*
+ * Moves what hangs below the dynamic nodes to their current world transforms.
+ * Returns whether an emitter moved and adds the BVH leaves of the moved
+ * primitives to `leaves`.
+ */
+static bool
+pose_dynamic(Scene &scene, std::vector<int> &leaves)
+{
+	bool emitters_moved = false;
+	for (const auto &mesh : scene.dynamic_meshes) {
+		const auto &transform = scene.nodes[mesh.node].total_transition;
+		for (size_t i = 0; i < mesh.vertices.size() / 3; i++) {
+			auto &primitive = scene.primitives[mesh.first_primitive + i];
+			for (int k = 0; k < 3; k++)
+				primitive.primitive_specific[k] = transform.transform(mesh.vertices[3 * i + k]);
+			leaves.push_back(scene.primitive_leaf[mesh.first_primitive + i]);
+			const auto &emission = primitive.material.emission;
+			emitters_moved |= emission.x > 0.f || emission.y > 0.f || emission.z > 0.f;
 		}
-		if (node_spec.HasMember("translation")) {
-			const auto &translation = node_spec["translation"].GetArray();
-			node.translation = {
-				translation[0].GetFloat(),
-				translation[1].GetFloat(),
-				translation[2].GetFloat()
-			};
+	}
+	for (const auto &dynamic : scene.dynamic_shapes) {
+		const auto &node = scene.nodes[dynamic.node];
+		// A shape animated to a zero scale keeps its last pose.
+		if (dynamic.unbounded) {
+			if (!pose_shape(node.shape, node.total_transition, scene.planes[dynamic.primitive]))
+				continue;
+			scene.plane_equations[dynamic.primitive] = plane_equation(scene.planes[dynamic.primitive]);
+			continue;
 		}
-		if (node_spec.HasMember("scale")) {
-			const auto &scale = node_spec["scale"].GetArray();
-			node.scale = {
-				scale[0].GetFloat(),
-				scale[1].GetFloat(),
-				scale[2].GetFloat()
-			};
+		auto &primitive = scene.primitives[dynamic.primitive];
+		if (!pose_shape(node.shape, node.total_transition, primitive))
+			continue;
+		leaves.push_back(scene.primitive_leaf[dynamic.primitive]);
+		const auto &emission = primitive.material.emission;
+		emitters_moved |= emission.x > 0.f || emission.y > 0.f || emission.z > 0.f;
+	}
+	for (size_t i = 0; i < scene.camera_nodes.size(); i++)
+		if (scene.nodes[scene.camera_nodes[i]].dynamic)
+			scene.cameras[i] = camera_from_node(scene.nodes[scene.camera_nodes[i]], scene.cameras[i]);
+	if (!scene.cameras.empty())
+		scene.camera = scene.cameras.back();
+	return emitters_moved;
+}
+
+void
+Scene::set_time(float time)
+{
+	if (animation_channels.empty())
+		return;
+	for (const auto &channel : animation_channels) {
+		auto &node = nodes[channel.node];
+		auto value = sample_channel(channel, time);
+		switch (channel.path) {
+			case (GltfAnimationPath::TRANSLATION):
+				node.translation = glm::vec3(value);
+				break;
+			case (GltfAnimationPath::ROTATION):
+				node.rotation = glm::quat(value.w, value.x, value.y, value.z);
+				break;
+			case (GltfAnimationPath::SCALE):
+				node.scale = glm::vec3(value);
+				break;
+			default:
+				unreachable();
 		}
-		if (node_spec.HasMember("children")) {
-			const auto &children = node_spec["children"].GetArray();
-			for (const auto &child : children)
-				node.children.push_back(child.GetUint());
+	}
+	for (const auto &channel : animation_channels)
+		nodes[channel.node].transition = Transform(nodes[channel.node].translation,
+							   nodes[channel.node].rotation,
+							   nodes[channel.node].scale);
+	for (size_t id = 0; id < nodes.size(); id++)
+		if (nodes[id].dynamic && (!nodes[id].parent_node.has_value() || !nodes[nodes[id].parent_node.value()].dynamic))
+			update_node(*this, id);
+
+	std::vector<int> leaves;
+	if (pose_dynamic(*this, leaves))
+		distribution = build_distribution(*this);
+	if (leaves.empty())
+		return;
+	bvh.refit(leaves);
+	if (bvh.sah_cost() > bvh_rebuild_ratio * bvh_built_cost)
+		build_bvh(*this);
+}
+
+/*
+ * Restores the saved transforms rather than composing them again, so the
+ * primitives come back bit for bit, and builds the BVH and the emitter
+ * distribution as loading did instead of refitting whatever the animation left.
+ */
+void
+Scene::reset_time()
+{
+	if (animation_channels.empty())
+		return;
+	for (const auto &pose : loaded_poses) {
+		auto &node = nodes[pose.node];
+		node.translation = pose.translation;
+		node.rotation = pose.rotation;
+		node.scale = pose.scale;
+		node.transition = pose.transition;
+		node.total_transition = pose.total_transition;
+	}
+	std::vector<int> leaves;
+	if (pose_dynamic(*this, leaves))
+		distribution = build_distribution(*this);
+	if (!leaves.empty())
+		build_bvh(*this);
+}
+
+float
+Scene::animation_duration() const
+{
+	float duration = 0.f;
+	for (const auto &channel : animation_channels)
+		if (!channel.times.empty())
+			duration = std::max(duration, channel.times.back());
+	return duration;
+}
+
+// Part of a data URI's base64 text, decoded independently of the others.
+struct EncodedRange {
+	size_t buffer;
+	std::string_view text;
+	size_t offset;
+};
+
+// Characters per range, a multiple of 4.
+static const size_t encoded_range_size = 1 << 16;
+// Decoded buffers start on a boundary that suits any accessor component type.
+static const size_t buffer_alignment = 16;
+
+/*
+ * Buffers without a uri are the BIN chunk of a GLB file, and EXT_meshopt_compression
+ * fallback buffers are left to decode_meshopt_views. Data URIs are
+ * base64 decoded into buffers of their own, in ranges spread across threads
+ * so that neither many small buffers nor one large one decode serially.
+ */
+void load_buffers(std::string_view gltf_file_name, const std::vector<GltfBufferSpec> &buffer_specs,
+		  const GltfBuffer &binary_chunk, Scene &scene) {
+	// Decoded buffers share one arena chunk, sized from the fallback lengths and the encoded URI lengths.
+	size_t decoded_size = 0;
+	for (const auto &buffer_spec : buffer_specs) {
+		if (buffer_spec.fallback)
+			decoded_size += buffer_spec.byte_length + buffer_alignment;
+		else if (buffer_spec.uri.compare(0, 5, "data:") == 0)
+			decoded_size += buffer_spec.uri.size() / 4 * 3 + buffer_alignment;
+	}
+	scene.arena.reserve(decoded_size);
+
+	std::vector<EncodedRange> ranges;
+	for (const auto &buffer_spec : buffer_specs) {
+		size_t buffer_len = buffer_spec.byte_length;
+		GltfBuffer buf;
+		if (buffer_spec.fallback) {
+			buf.assign((char*)scene.arena.allocate(buffer_len, buffer_alignment), buffer_len);
+			scene.buffers.push_back(std::move(buf));
+			continue;
 		}
-		if (node_spec.HasMember("matrix")) {
-			const auto &matrix = node_spec["matrix"].GetArray();
-			float transition[4][4];
-			for (size_t i = 0; i < 16; i++)
-				transition[i % 4][i / 4] = matrix[i].GetFloat();
-			node.transition = Transform(transition);
+		if (buffer_spec.uri.empty()) {
+			if (binary_chunk.size() >= buffer_len)
+				buf = binary_chunk.slice(0, buffer_len);
+			else
+				std::cerr << "missing GLB binary chunk" << std::endl;
+			scene.buffers.push_back(std::move(buf));
+			continue;
 		}
-		if (!node.transition.has_value())
-			node.transition = Transform(node.translation, node.rotation, node.scale);
-		scene.nodes.push_back(std::move(node));
+		if (buffer_spec.uri.compare(0, 5, "data:") == 0) {
+			std::string_view uri = buffer_spec.uri;
+			const auto comma = uri.find(',');
+			const auto text = uri.substr(comma + 1);
+			const auto size = base64_decoded_size(text);
+			if (comma == std::string_view::npos || uri.substr(0, comma).size() < 7 ||
+			    uri.substr(comma - 7, 7) != ";base64" || size == SIZE_MAX || size < buffer_len) {
+				std::cerr << "unsupported data URI in buffer " << scene.buffers.size() << std::endl;
+			} else {
+				buf.assign((char*)scene.arena.allocate(size, buffer_alignment), size);
+				for (size_t begin = 0; begin < text.size(); begin += encoded_range_size)
+					ranges.push_back({scene.buffers.size(), text.substr(begin, encoded_range_size),
+							  begin / 4 * 3});
+			}
+			scene.buffers.push_back(std::move(buf));
+			continue;
+		}
+		const auto gltf_file_path = std::filesystem::path(gltf_file_name);
+		const auto buffer_file_path = gltf_file_path.parent_path().append(buffer_spec.uri);
+		// A buffer that cannot be mapped stays empty, and the accessors into it are skipped.
+		if (buf.map(buffer_file_path.string()) && buf.size() >= buffer_len)
+			buf = buf.slice(0, buffer_len);
+		else
+			std::cerr << "cannot map " << buffer_file_path << std::endl;
+		scene.buffers.push_back(std::move(buf));
+	}
+	if (ranges.empty())
+		return;
+
+	std::vector<char> decoded(ranges.size());
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t r = 0; r < ranges.size(); r++)
+		decoded[r] = decode_base64(ranges[r].text, scene.buffers[ranges[r].buffer].mutable_data() + ranges[r].offset);
+	std::vector<char> valid(scene.buffers.size(), 1);
+	for (size_t r = 0; r < ranges.size(); r++)
+		valid[ranges[r].buffer] &= decoded[r];
+	for (size_t i = 0; i < scene.buffers.size(); i++) {
+		if (!valid[i]) {
+			std::cerr << "invalid base64 in buffer " << i << std::endl;
+			scene.buffers[i] = GltfBuffer();
+		} else if (buffer_specs[i].uri.compare(0, 5, "data:") == 0 && scene.buffers[i].size() > 0) {
+			scene.buffers[i] = scene.buffers[i].slice(0, buffer_specs[i].byte_length);
+		}
+	}
+}
+
+// Whether [offset, offset + length) lies within size bytes, without the sum wrapping.
+static bool
+fits(size_t offset, size_t length, size_t size)
+{
+	return offset <= size && length <= size - offset;
+}
+
+/*
+ * Decodes every EXT_meshopt_compression buffer view into its fallback
+ * buffer, one view per task. Views that fail to decode are zeroed, so their
+ * indices fail validation rather than reading stale memory.
+ */
+static void
+decode_meshopt_views(const std::vector<GltfBufferSpec> &buffer_specs, Scene &scene)
+{
+	std::vector<size_t> views;
+	for (size_t i = 0; i < scene.bufferViews.size(); i++)
+		if (scene.bufferViews[i].meshopt.has_value())
+			views.push_back(i);
+	std::vector<char> decoded(views.size());
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t v = 0; v < views.size(); v++) {
+		const auto &view = scene.bufferViews[views[v]];
+		const auto &meshopt = view.meshopt.value();
+		if (view.buffer >= scene.buffers.size() || !buffer_specs[view.buffer].fallback ||
+		    !fits(view.byte_offset, view.byte_length, scene.buffers[view.buffer].size()))
+			continue;
+		auto *out = (uint8_t*)scene.buffers[view.buffer].mutable_data() + view.byte_offset;
+		if (meshopt.buffer < scene.buffers.size() && meshopt.mode.has_value() &&
+		    (meshopt.byte_stride == 0 || meshopt.count <= view.byte_length / meshopt.byte_stride) &&
+		    fits(meshopt.byte_offset, meshopt.byte_length, scene.buffers[meshopt.buffer].size())) {
+			const auto *data = (const uint8_t*)scene.buffers[meshopt.buffer].data() + meshopt.byte_offset;
+			decoded[v] = meshopt_decode(meshopt.mode.value(), meshopt.filter, meshopt.count,
+						    meshopt.byte_stride, data, meshopt.byte_length, out);
+		}
+		if (!decoded[v])
+			memset(out, 0, view.byte_length);
 	}
-	for (size_t i = 0; i < scene.nodes.size(); i++)
-		for (const auto &child : scene.nodes[i].children)
+	for (size_t v = 0; v < views.size(); v++)
+		if (!decoded[v])
+			std::cerr << "cannot decode compressed buffer view " << views[v] << std::endl;
+}
+
+// Links children to their parents and composes every node's world transform.
+void load_nodes(Scene &scene) {
+	for (size_t i = 0; i < scene.nodes.size(); i++) {
+		auto &children = scene.nodes[i].children;
+		children.erase(std::remove_if(children.begin(), children.end(),
+					      [&](size_t child) { return child >= scene.nodes.size(); }),
+			       children.end());
+		for (const auto &child : children)
 			scene.nodes[child].parent_node = i;
+	}
 	for (auto &node : scene.nodes) {
 		node.total_transition = node.transition.value();
 		auto parent = node.parent_node;
@@ -148,174 +436,372 @@ void load_nodes(const rapidjson::Document &gltfScene, Scene &scene) {
 	}
 }
 
-void load_meshes(const rapidjson::Document &gltfScene, Scene &scene) {
-	const auto &mesh_specs = gltfScene["meshes"].GetArray();
-	for (const auto &mesh_spec : mesh_specs) {
-		GltfMesh mesh;
-		for (const auto &primitive : mesh_spec["primitives"].GetArray()) {
-			mesh.primitives.push_back(GltfPrimitive{
-				primitive["attributes"]["POSITION"].GetUint(),
-				primitive["indices"].GetUint(),
-				primitive["material"].GetUint()
-			});
+// Triangles of one mesh primitive as instanced by one node.
+struct TriangleBatch {
+	size_t node;
+	const GltfPrimitive *primitive;
+	AccessorData positions;
+	AccessorData indices;
+	// Float positions and uint32 indices, either the accessors' own packed data or converted by load_primitives.
+	const glm::vec3 *local;
+	const uint32_t *corners;
+	size_t vertex_count;
+	size_t triangle_count;
+	// Offsets into the world space vertices, the converted vertices and indices, and scene.primitives.
+	size_t first_vertex;
+	size_t first_converted;
+	size_t first_widened;
+	size_t first_triangle;
+	// Index into scene.dynamic_meshes, or -1.
+	int dynamic_mesh;
+};
+
+// A range of one batch's vertices or triangles, the unit of parallel work.
+struct BatchRange {
+	size_t batch;
+	size_t begin;
+	size_t end;
+};
+
+static const size_t batch_range_size = 4096;
+
+static std::vector<BatchRange>
+split_batches(const std::vector<TriangleBatch> &batches, size_t TriangleBatch::*count)
+{
+	std::vector<BatchRange> ranges;
+	for (size_t i = 0; i < batches.size(); i++)
+		for (size_t begin = 0; begin < batches[i].*count; begin += batch_range_size)
+			ranges.push_back({i, begin, std::min(begin + batch_range_size, batches[i].*count)});
+	return ranges;
+}
+
+/*
+ * Extracts triangles in two phases. The first sizes every (node, primitive)
+ * pair, widens indices that are not packed uint32 while checking them,
+ * drops pairs with indices out of range and gives the rest their slices of
+ * the output. The second fills the preallocated primitives in parallel,
+ * transforming each vertex once per instance rather than once per triangle
+ * corner. Positions that are not packed floats are converted in the same
+ * pass.
+ */
+void load_primitives(Scene &scene) {
+	ScratchScope scratch;
+	std::vector<TriangleBatch> batches;
+	size_t widened_count = 0;
+	for (size_t node_id = 0; node_id < scene.nodes.size(); node_id++) {
+		const auto &node = scene.nodes[node_id];
+		if (!node.mesh.has_value() || node.mesh.value() >= scene.meshes.size())
+			continue;
+		for (const auto &gltf_primitive : scene.meshes[node.mesh.value()].primitives) {
+			if (gltf_primitive.positions >= scene.accessors.size() ||
+			    gltf_primitive.indices >= scene.accessors.size() ||
+			    gltf_primitive.material >= scene.materials.size())
+				continue;
+			TriangleBatch batch = {};
+			batch.node = node_id;
+			batch.primitive = &gltf_primitive;
+			if (!accessor_data(scene.accessors[gltf_primitive.positions], scene.bufferViews, scene.buffers,
+					   batch.positions) ||
+			    !accessor_data(scene.accessors[gltf_primitive.indices], scene.bufferViews, scene.buffers,
+					   batch.indices))
+				continue;
+			if (batch.positions.components != 3 || batch.indices.components != 1 ||
+			    batch.indices.component_type == 5120 || batch.indices.component_type == 5122 ||
+			    batch.indices.component_type == 5126)
+				continue;
+			batch.vertex_count = batch.positions.count;
+			batch.triangle_count = batch.indices.count / 3;
+			batch.first_widened = widened_count;
+			if (!packed_indices(batch.indices))
+				widened_count += 3 * batch.triangle_count;
+			batches.push_back(batch);
 		}
-		scene.meshes.push_back(std::move(mesh));
 	}
-}
 
-void load_accessors(const rapidjson::Document &gltfScene, Scene &scene) {
-	const auto &accessor_specs = gltfScene["accessors"].GetArray();
-	for (const auto &accessor_spec : accessor_specs) {
-		auto accessor = GltfAccessor{
-			accessor_spec["bufferView"].GetUint(),
-			accessor_spec["count"].GetUint(),
-			accessor_spec["componentType"].GetUint(),
-			accessor_spec["type"].GetString(),
-			0
-		};
-		if (accessor_spec.HasMember("byteOffset"))
-			accessor.byte_offset = (size_t)accessor_spec["byteOffset"].GetFloat();
-		scene.accessors.push_back(std::move(accessor));
+	// Scratch arrays start uninitialized, so their pages are first touched by the parallel phases that fill them.
+	auto *widened = scratch.allocate<uint32_t>(widened_count);
+	for (auto &batch : batches)
+		batch.corners = packed_indices(batch.indices) ? (const uint32_t*)batch.indices.data
+							      : widened + batch.first_widened;
+	auto ranges = split_batches(batches, &TriangleBatch::triangle_count);
+	std::vector<char> range_valid(ranges.size());
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t r = 0; r < ranges.size(); r++) {
+		const auto &batch = batches[ranges[r].batch];
+		const size_t begin = 3 * ranges[r].begin, count = 3 * (ranges[r].end - ranges[r].begin);
+		if (!packed_indices(batch.indices))
+			read_indices(batch.indices, begin, count, widened + batch.first_widened + begin);
+		uint32_t max_index = 0;
+		#pragma omp simd reduction(max:max_index)
+		for (size_t i = begin; i < begin + count; i++)
+			max_index = std::max(max_index, batch.corners[i]);
+		range_valid[r] = max_index < batch.vertex_count;
 	}
-}
+	std::vector<char> batch_valid(batches.size(), 1);
+	for (size_t r = 0; r < ranges.size(); r++)
+		batch_valid[ranges[r].batch] &= range_valid[r];
 
-void load_materials(const rapidjson::Document &gltfScene, Scene &scene) {
-	const auto &material_specs = gltfScene["materials"].GetArray();
-	for (const auto &material_spec : material_specs) {
-		GltfMaterial material;
-		if (material_spec.HasMember("pbrMetallicRoughness")) {
-			if (material_spec["pbrMetallicRoughness"].HasMember("baseColorFactor")) {
-				auto color = material_spec["pbrMetallicRoughness"]["baseColorFactor"].GetArray();
-				material.color = Color{
-					color[0].GetFloat(),
-					color[1].GetFloat(),
-					color[2].GetFloat()
-				};
-				material.alpha = color[3].GetFloat();
-			}
-			if (material_spec["pbrMetallicRoughness"].HasMember("metallicFactor"))
-				material.metallic_factor = material_spec["pbrMetallicRoughness"]["metallicFactor"].GetFloat();
-		}
-		if (material_spec.HasMember("emissiveFactor")) {
-			const auto emission = material_spec["emissiveFactor"].GetArray();
-			material.emission = Color{
-				emission[0].GetFloat(),
-				emission[1].GetFloat(),
-				emission[2].GetFloat()
-			};
+	std::vector<TriangleBatch> valid;
+	size_t vertex_count = 0, converted_count = 0, triangle_count = scene.primitives.size();
+	for (size_t i = 0; i < batches.size(); i++) {
+		if (!batch_valid[i])
+			continue;
+		auto batch = batches[i];
+		batch.dynamic_mesh = -1;
+		if (scene.nodes[batch.node].dynamic) {
+			if (scene.dynamic_meshes.empty() || scene.dynamic_meshes.back().node != batch.node)
+				scene.dynamic_meshes.push_back({batch.node, triangle_count, {}});
+			batch.dynamic_mesh = (int)scene.dynamic_meshes.size() - 1;
+			scene.dynamic_meshes.back().vertices.resize(
+				scene.dynamic_meshes.back().vertices.size() + 3 * batch.triangle_count);
 		}
-		if (material_spec.HasMember("extensions") && material_spec["extensions"].HasMember("KHR_materials_emissive_strength")) {
-			float emission_factor = material_spec["extensions"]["KHR_materials_emissive_strength"]["emissiveStrength"].GetFloat();
-			material.emission *= emission_factor;
+		batch.first_vertex = vertex_count;
+		batch.first_triangle = triangle_count;
+		batch.first_converted = converted_count;
+		if (!packed_floats(batch.positions))
+			converted_count += batch.vertex_count;
+		vertex_count += batch.vertex_count;
+		triangle_count += batch.triangle_count;
+		valid.push_back(batch);
+	}
+	batches = std::move(valid);
+
+	auto *world = scratch.allocate<glm::vec3>(vertex_count);
+	auto *converted = scratch.allocate<glm::vec3>(converted_count);
+	for (auto &batch : batches)
+		batch.local = packed_floats(batch.positions) ? (const glm::vec3*)batch.positions.data
+							      : converted + batch.first_converted;
+	ranges = split_batches(batches, &TriangleBatch::vertex_count);
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t r = 0; r < ranges.size(); r++) {
+		const auto &batch = batches[ranges[r].batch];
+		const size_t begin = ranges[r].begin, count = ranges[r].end - ranges[r].begin;
+		if (!packed_floats(batch.positions))
+			read_floats(batch.positions, begin, count, (float*)(converted + batch.first_converted + begin));
+		scene.nodes[batch.node].total_transition.transform_points(batch.local + begin, count,
+									  world + batch.first_vertex + begin);
+	}
+
+	// Leaves room for the shapes load_shapes appends, so the triangles are not copied once more.
+	size_t shape_count = 0;
+	for (const auto &node : scene.nodes)
+		shape_count += node.shape.type.has_value();
+	scene.primitives.reserve(triangle_count + shape_count);
+	scene.primitives.resize(triangle_count);
+	ranges = split_batches(batches, &TriangleBatch::triangle_count);
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t r = 0; r < ranges.size(); r++) {
+		const auto &batch = batches[ranges[r].batch];
+		const auto &material = scene.materials[batch.primitive->material];
+		for (size_t i = ranges[r].begin; i < ranges[r].end; i++) {
+			// Triangles are wound pos1, pos3, pos2.
+			const uint32_t corners[3] = {batch.corners[3 * i], batch.corners[3 * i + 2], batch.corners[3 * i + 1]};
+			auto &primitive = scene.primitives[batch.first_triangle + i];
+			primitive.type = FigureType::TRIANGLE;
+			for (int k = 0; k < 3; k++)
+				primitive.primitive_specific[k] = world[batch.first_vertex + corners[k]];
+			primitive.material = material;
+			primitive.material_id = (int)batch.primitive->material;
+			if (batch.dynamic_mesh >= 0) {
+				auto &mesh = scene.dynamic_meshes[batch.dynamic_mesh];
+				auto *local = mesh.vertices.data() + 3 * (batch.first_triangle + i - mesh.first_primitive);
+				for (int k = 0; k < 3; k++)
+					local[k] = batch.local[corners[k]];
+			}
 		}
-		if (material.alpha < 1)
-			material.material = Material::DIELECTRIC;
-		else if (material.metallic_factor > 0)
-			material.material = Material::METALLIC;
-		scene.materials.push_back(material);
 	}
 }
 
-void load_primitives(Scene &scene) {
-	for (const auto &node : scene.nodes) {
-		if (!node.mesh.has_value())
+/*
+ * Instantiates the analytic shapes of node extras, one primitive each.
+ * Ellipsoids and boxes join the triangles in the BVH and, when emissive, in
+ * the emitter distribution. Planes clipped to a finite box join the BVH as
+ * well; unbounded planes are traced on their own.
+ */
+void load_shapes(Scene &scene) {
+	for (size_t node_id = 0; node_id < scene.nodes.size(); node_id++) {
+		const auto &node = scene.nodes[node_id];
+		if (!node.shape.type.has_value())
+			continue;
+		if (node.shape.material >= scene.materials.size()) {
+			std::cerr << "shape of node " << node_id << " has no valid material, skipped" << std::endl;
 			continue;
-		const auto &mesh = node.mesh.value();
-		for (const auto &gltf_primitive : scene.meshes[mesh].primitives) {
-			std::vector<glm::vec3> positions;
-			{
-				const auto &accessor = scene.accessors[gltf_primitive.positions];
-				const auto &buffer_view = scene.bufferViews[accessor.buffer_view];
-				const auto &buffer = scene.buffers[buffer_view.buffer];
-				size_t byte_offset = buffer_view.byte_offset + accessor.byte_offset;
-				for (size_t i = 0; i < accessor.count; i++) {
-					glm::vec3 position;
-					position.x = *(reinterpret_cast<const float *>(buffer.data() + byte_offset +
-										       12 * i));
-					position.y = *(reinterpret_cast<const float *>(buffer.data() + byte_offset +
-										       12 * i + 4));
-					position.z = *(reinterpret_cast<const float *>(buffer.data() + byte_offset +
-										       12 * i + 8));
-					positions.push_back(position);
-				}
-			}
-			{
-				const auto &accessor = scene.accessors[gltf_primitive.indices];
-				const auto &buffer_view = scene.bufferViews[accessor.buffer_view];
-				const auto &buffer = scene.buffers[buffer_view.buffer];
-				const auto &material = scene.materials[gltf_primitive.material];
-				for (size_t i = 0; i < accessor.count; i += 3) {
-					size_t pos1, pos2, pos3;
-					if (accessor.component_type == 5123) {
-						pos1 = *(reinterpret_cast<const uint16_t *>(buffer.data() +
-											    buffer_view.byte_offset +
-											    2 * i));
-						pos2 = *(reinterpret_cast<const uint16_t *>(buffer.data() +
-											    buffer_view.byte_offset +
-											    2 * (i + 1)));
-						pos3 = *(reinterpret_cast<const uint16_t *>(buffer.data() +
-											    buffer_view.byte_offset +
-											    2 * (i + 2)));
-					} else {
-						pos1 = *(reinterpret_cast<const uint32_t *>(buffer.data() +
-											    buffer_view.byte_offset +
-											    4 * i));
-						pos2 = *(reinterpret_cast<const uint32_t *>(buffer.data() +
-											    buffer_view.byte_offset +
-											    4 * (i + 1)));
-						pos3 = *(reinterpret_cast<const uint32_t *>(buffer.data() +
-											    buffer_view.byte_offset +
-											    4 * (i + 2)));
-					}
-					Primitive primitive;
-					primitive.type = FigureType::TRIANGLE;
-					primitive.primitive_specific[0] = node.total_transition.transform(
-						positions[pos1]);
-					primitive.primitive_specific[1] = node.total_transition.transform(
-						positions[pos3]);
-					primitive.primitive_specific[2] = node.total_transition.transform(
-						positions[pos2]);
-					primitive.material = material;
-					scene.primitives.push_back(primitive);
-				}
-			}
 		}
+		Primitive primitive;
+		switch (node.shape.type.value()) {
+			case (GltfShapeType::ELLIPSOID):
+				primitive.type = FigureType::ELLIPSOID;
+				break;
+			case (GltfShapeType::BOX):
+				primitive.type = FigureType::BOX;
+				break;
+			case (GltfShapeType::PLANE):
+				primitive.type = FigureType::PLANE;
+				break;
+			default:
+				unreachable();
+		}
+		primitive.material = scene.materials[node.shape.material];
+		primitive.material_id = (int)node.shape.material;
+		if (!pose_shape(node.shape, node.total_transition, primitive)) {
+			std::cerr << "shape of node " << node_id << " has a zero scale, skipped" << std::endl;
+			continue;
+		}
+		const auto bounds = build_aabb(&primitive);
+		const bool unbounded = primitive.type == FigureType::PLANE &&
+				       !glm::all(glm::lessThan(bounds.aabb_max - bounds.aabb_min, glm::vec3(INF)));
+		auto &target = unbounded ? scene.planes : scene.primitives;
+		if (node.dynamic)
+			scene.dynamic_shapes.push_back({node_id, target.size(), unbounded});
+		target.push_back(primitive);
 	}
 }
 
-void load_camera(const rapidjson::Document &gltfScene, Scene &scene) {
+void load_camera(const std::vector<std::optional<float>> &camera_fovs, Scene &scene) {
 	scene.camera.up = {0, 1, 0};
 	scene.camera.forward = {0, 0, -1};
 	scene.camera.right = {1, 0, 0};
 
-	for (const auto &node : scene.nodes) {
-		if (node.camera.has_value()) {
-			scene.camera.fov_y = gltfScene["cameras"].GetArray()[node.camera.value()]["perspective"]["yfov"].GetFloat();
-			scene.camera.position = node.total_transition.transform({0, 0, 0});
-			scene.camera.up = node.total_transition.transform(scene.camera.up) - scene.camera.position;
-			scene.camera.right = node.total_transition.transform(scene.camera.right) - scene.camera.position;
-			scene.camera.forward =
-				node.total_transition.transform(scene.camera.forward) - scene.camera.position;
+	for (size_t i = 0; i < scene.nodes.size(); i++) {
+		const auto &node = scene.nodes[i];
+		// Only perspective cameras are supported.
+		if (node.camera.has_value() && node.camera.value() < camera_fovs.size() &&
+		    camera_fovs[node.camera.value()].has_value()) {
+			Camera camera = scene.camera;
+			camera.fov_y = camera_fovs[node.camera.value()].value();
+			scene.cameras.push_back(camera_from_node(node, camera));
+			scene.camera_nodes.push_back(i);
 		}
 	}
+	if (!scene.cameras.empty())
+		scene.camera = scene.cameras.back();
+}
+
+// Reads an accessor of `components` floats per element, converting normalized integers.
+static std::vector<float>
+accessor_floats(const Scene &scene, size_t accessor_id, int components)
+{
+	AccessorData accessor;
+	if (!accessor_data(scene.accessors[accessor_id], scene.bufferViews, scene.buffers, accessor) ||
+	    accessor.components != components)
+		return {};
+	std::vector<float> values(accessor.count * components);
+	read_floats(accessor, 0, accessor.count, values.data());
+	return values;
+}
+
+static void
+mark_dynamic(Scene &scene, size_t id)
+{
+	scene.nodes[id].dynamic = true;
+	for (auto child : scene.nodes[id].children)
+		mark_dynamic(scene, child);
+}
+
+void load_animations(const std::vector<GltfAnimation> &animations, Scene &scene) {
+	for (const auto &animation : animations) {
+		for (const auto &target : animation.channels) {
+			if (!target.node.has_value() || !target.path.has_value() || target.node.value() >= scene.nodes.size() ||
+			    target.sampler >= animation.samplers.size())
+				continue;
+			const auto &sampler = animation.samplers[target.sampler];
+			if (sampler.input >= scene.accessors.size() || sampler.output >= scene.accessors.size())
+				continue;
+			GltfAnimationChannel channel;
+			channel.node = target.node.value();
+			channel.path = target.path.value();
+			channel.interpolation = sampler.interpolation;
+			channel.times = accessor_floats(scene, sampler.input, 1);
+			const int components = (channel.path == GltfAnimationPath::ROTATION) ? 4 : 3;
+			auto values = accessor_floats(scene, sampler.output, components);
+			for (size_t i = 0; i < values.size(); i += components)
+				channel.values.emplace_back(values[i], values[i + 1], values[i + 2],
+							    (components == 4) ? values[i + 3] : 0.f);
+			const size_t keys = (channel.interpolation == GltfInterpolation::CUBICSPLINE ? 3 : 1) * channel.times.size();
+			if (channel.times.empty() || channel.values.size() != keys)
+				continue;
+			mark_dynamic(scene, channel.node);
+			scene.animation_channels.push_back(std::move(channel));
+		}
+	}
+	for (size_t id = 0; id < scene.nodes.size(); id++) {
+		const auto &node = scene.nodes[id];
+		if (node.dynamic)
+			scene.loaded_poses.push_back({id, node.translation, node.rotation, node.scale,
+						      node.transition.value(), node.total_transition});
+	}
+}
+
+static const uint32_t glb_magic = 0x46546C67;
+static const uint32_t glb_version = 2;
+static const uint32_t glb_json_chunk = 0x4E4F534A;
+static const uint32_t glb_binary_chunk = 0x004E4942;
+
+/*
+ * Parses a GLB container: a 12 byte header, a JSON chunk and an optional BIN
+ * chunk. The JSON is parsed in situ in the file's copy-on-write mapping, and
+ * the BIN chunk is handed out as a slice of the same mapping.
+ */
+static bool
+parse_glb(GltfBuffer &file, GltfDocument &document, GltfBuffer &binary_chunk)
+{
+	uint32_t header[3];
+	if (file.size() < sizeof(header) + 8)
+		return false;
+	memcpy(header, file.data(), sizeof(header));
+	uint32_t chunk[2];
+	const size_t json_offset = sizeof(header) + sizeof(chunk);
+	// The declared length must cover the JSON chunk header before anything is subtracted from it.
+	if (header[0] != glb_magic || header[1] != glb_version || header[2] > file.size() || header[2] < json_offset)
+		return false;
+	const size_t length = header[2];
+
+	memcpy(chunk, file.data() + sizeof(header), sizeof(chunk));
+	if (chunk[1] != glb_json_chunk || chunk[0] > length - json_offset)
+		return false;
+	const size_t json_length = chunk[0];
+	const size_t json_end = json_offset + json_length;
+	if (json_end + sizeof(chunk) <= length) {
+		memcpy(chunk, file.data() + json_end, sizeof(chunk));
+		if (chunk[1] == glb_binary_chunk && chunk[0] <= length - json_end - sizeof(chunk))
+			binary_chunk = file.slice(json_end + sizeof(chunk), chunk[0]);
+	}
+	// Once read, the next chunk header can take the terminator of an unpadded JSON chunk.
+	return parse_gltf_json(file.mutable_data() + json_offset, json_length, json_end < length, document);
 }
 
 Scene load_scene(std::string_view gltfFilename) {
+	using Clock = std::chrono::steady_clock;
+	const auto start = Clock::now();
 	Scene scene;
 
-	std::ifstream in(gltfFilename.data(), std::ios_base::binary);
-	rapidjson::IStreamWrapper isw(in);
-	rapidjson::Document gltfScene;
-	gltfScene.ParseStream(isw);
-	load_buffers(gltfFilename, gltfScene, scene);
-	load_buffer_views(gltfScene, scene);
-	load_nodes(gltfScene, scene);
-	load_meshes(gltfScene, scene);
-	load_accessors(gltfScene, scene);
-	load_materials(gltfScene, scene);
+	GltfBuffer file, binary_chunk;
+	GltfDocument document;
+	if (!file.map(std::string(gltfFilename), true)) {
+		std::cerr << "cannot map " << gltfFilename << std::endl;
+	} else if (file.size() >= 4 && memcmp(file.data(), &glb_magic, 4) == 0) {
+		if (!parse_glb(file, document, binary_chunk))
+			std::cerr << "malformed GLB file " << gltfFilename << std::endl;
+	} else {
+		// The rest of the last mapped page reads as zeros and may take the terminator.
+		parse_gltf_json(file.mutable_data(), file.size(), file.size() % sysconf(_SC_PAGESIZE) != 0, document);
+	}
+	scene.parse_ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+	load_buffers(gltfFilename, document.buffers, binary_chunk, scene);
+	scene.bufferViews = std::move(document.buffer_views);
+	decode_meshopt_views(document.buffers, scene);
+	scene.nodes = std::move(document.nodes);
+	scene.meshes = std::move(document.meshes);
+	scene.accessors = std::move(document.accessors);
+	scene.materials = std::move(document.materials);
+	load_nodes(scene);
+	load_animations(document.animations, scene);
 	load_primitives(scene);
-	load_camera(gltfScene, scene);
+	load_shapes(scene);
+	load_camera(document.camera_fovs, scene);
 
 	scene.init();
+	scene.load_ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
 	return scene;
-}
\ No newline at end of file
+}
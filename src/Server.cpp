@@ -0,0 +1,184 @@
+#include <Server.hpp>
+
+#include <Job.hpp>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+SceneCache::SceneCache(size_t capacity) :
+	capacity(std::max<size_t>(capacity, 1)) {}
+
+Scene *
+SceneCache::get(const std::string &path)
+{
+	std::error_code error;
+	auto key = std::filesystem::weakly_canonical(path, error).string();
+	auto modified = std::filesystem::last_write_time(key, error);
+	if (error)
+		return nullptr;
+
+	auto it = index.find(key);
+	if (it != index.end()) {
+		if (it->second->modified == modified) {
+			entries.splice(entries.begin(), entries, it->second);
+			return entries.front().scene.get();
+		}
+		entries.erase(it->second);
+		index.erase(it);
+	}
+	entries.push_front({key, modified, std::make_unique<Scene>(load_scene(key))});
+	fprintf(stderr, "loaded %s in %.1f ms, %.1f ms of it parsing JSON\n", key.c_str(),
+		entries.front().scene->load_ms, entries.front().scene->parse_ms);
+	index[key] = entries.begin();
+	while (entries.size() > capacity) {
+		index.erase(entries.back().path);
+		entries.pop_back();
+	}
+	return entries.front().scene.get();
+}
+
+static std::vector<std::string>
+split(const char *line)
+{
+	std::vector<std::string> words;
+	std::istringstream stream(line);
+	for (std::string word; stream >> word;)
+		words.push_back(word);
+	return words;
+}
+
+static void
+run(const std::vector<std::string> &words, FILE *out, SceneCache &cache)
+{
+	std::vector<const char*> args;
+	for (const auto &word : words)
+		args.push_back(word.c_str());
+	RenderJob job;
+	if (!parse_job((int)args.size(), args.data(), job)) {
+		fprintf(out, "error usage: %s\n", job_usage);
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto scene = cache.get(job.scene);
+	if (scene == nullptr) {
+		fprintf(out, "error cannot load %s\n", job.scene.c_str());
+		return;
+	}
+	if (!job.options.cameras.empty() || job.options.frames > 0) {
+		bool rendered = run_batch(*scene, job);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (rendered)
+			fprintf(out, "ok %.1f\n", elapsed.count());
+		else
+			fprintf(out, "error cannot render %s\n", job.scene.c_str());
+		return;
+	}
+	Image image(0, 0);
+	if (!run_job(*scene, job, image)) {
+		fprintf(out, "error cannot render %s\n", job.scene.c_str());
+		return;
+	}
+
+	if (job.output == "-") {
+		std::ostringstream encoded;
+		image.save(encoded);
+		auto bytes = encoded.str();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		fprintf(out, "ok %.1f %zu\n", elapsed.count(), bytes.size());
+		fwrite(bytes.data(), 1, bytes.size(), out);
+	} else {
+		std::ofstream file(job.output, std::ios::binary);
+		image.save(file);
+		file.close();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		fprintf(out, "ok %.1f\n", elapsed.count());
+	}
+}
+
+// Serves jobs until the input ends; returns false once asked to quit.
+static bool
+serve_stream(FILE *in, FILE *out, SceneCache &cache)
+{
+	char *line = nullptr;
+	size_t line_capacity = 0;
+	bool running = true;
+	while (getline(&line, &line_capacity, in) > 0) {
+		auto words = split(line);
+		if (words.empty())
+			continue;
+		if (words[0] == "quit") {
+			running = false;
+			break;
+		}
+		run(words, out, cache);
+		fflush(out);
+	}
+	free(line);
+	return running;
+}
+
+static int
+serve_socket(const std::string &path, SceneCache &cache)
+{
+	sockaddr_un address{};
+	if (path.size() >= sizeof(address.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", path.c_str());
+		return 1;
+	}
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path.c_str());
+	if (listener < 0 || bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+		perror("socket");
+		if (listener >= 0)
+			close(listener);
+		return 1;
+	}
+	// A client hanging up mid-reply must not take the server down.
+	signal(SIGPIPE, SIG_IGN);
+
+	// Connections are served one at a time, each job already uses every core.
+	bool running = true;
+	while (running) {
+		int client = accept(listener, nullptr, nullptr);
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		FILE *in = fdopen(client, "r");
+		FILE *out = fdopen(dup(client), "w");
+		running = serve_stream(in, out, cache);
+		fclose(out);
+		fclose(in);
+	}
+	close(listener);
+	unlink(path.c_str());
+	return 0;
+}
+
+int
+serve(const ServerOptions &options)
+{
+	SceneCache cache(options.cache_size);
+	if (options.socket.empty()) {
+		serve_stream(stdin, stdout, cache);
+		return 0;
+	}
+	return serve_socket(options.socket, cache);
+}
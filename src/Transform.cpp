@@ -59,4 +59,19 @@ glm::vec3 Transform::transform(const glm::vec3 &p) const {
 	for (int i = 0; i < 3; i++)
 		result[i] = matrix_[i][0] * p.x + matrix_[i][1] * p.y + matrix_[i][2] * p.z + matrix_[i][3];
 	return {result[0], result[1], result[2]};
-}
\ No newline at end of file
+}
+
+void Transform::transform_points(const glm::vec3 *points, std::size_t count, glm::vec3 *result) const {
+	const auto *in = (const float*)points;
+	auto *out = (float*)result;
+	const float m00 = matrix_[0][0], m01 = matrix_[0][1], m02 = matrix_[0][2], m03 = matrix_[0][3];
+	const float m10 = matrix_[1][0], m11 = matrix_[1][1], m12 = matrix_[1][2], m13 = matrix_[1][3];
+	const float m20 = matrix_[2][0], m21 = matrix_[2][1], m22 = matrix_[2][2], m23 = matrix_[2][3];
+	#pragma omp simd
+	for (std::size_t i = 0; i < count; i++) {
+		const float x = in[3 * i], y = in[3 * i + 1], z = in[3 * i + 2];
+		out[3 * i] = m00 * x + m01 * y + m02 * z + m03;
+		out[3 * i + 1] = m10 * x + m11 * y + m12 * z + m13;
+		out[3 * i + 2] = m20 * x + m21 * y + m22 * z + m23;
+	}
+}
@@ -1,21 +1,80 @@
-#include "render.hpp"
+#include "Distributed.hpp"
+#include "HdrImage.hpp"
+#include "Job.hpp"
+#include "PostProcess.hpp"
+#include "Server.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+
+// Tonemaps a previously saved HDR image without rendering anything.
+static int
+tonemap_main(int argc, const char *argv[])
+{
+	RenderOptions options;
+	if (argc < 4 || !parse_options(argc, argv, 4, options)) {
+		std::cerr << "usage: " << argv[0] << " --tonemap input.pfm|input.exr output [--exposure stops]" << std::endl;
+		return 1;
+	}
+	HdrImage hdr;
+	std::ifstream in(argv[2], std::ios::binary);
+	if (!hdr.load(in)) {
+		std::cerr << "cannot read " << argv[2] << std::endl;
+		return 1;
+	}
+	Image image(hdr.m_height, hdr.m_width);
+	if (hdr.m_channels == 3)
+		tonemap(hdr.data.data(), image.raw.data(), hdr.data.size(), options.exposure);
+	else
+		image = tonemap(hdr.pixels(), hdr.m_height, hdr.m_width, options.exposure);
+	std::ofstream out(argv[3], std::ios::binary);
+	image.save(out);
+	return 0;
+}
+
+static int
+server_main(int argc, const char *argv[])
+{
+	ServerOptions options;
+	for (int i = 2; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "--socket") == 0) {
+			options.socket = argv[++i];
+		} else if (i + 1 < argc && strcmp(argv[i], "--cache") == 0) {
+			options.cache_size = (size_t)std::max(1L, strtol(argv[++i], nullptr, 10));
+		} else {
+			std::cerr << "usage: " << argv[0] << " --server [--socket path] [--cache scenes]" << std::endl;
+			return 1;
+		}
+	}
+	return serve(options);
+}
 
 int main(int argc, const char *argv[]) {
-	assert(argc >= 5);
+	if (argc >= 2 && strcmp(argv[1], "--tonemap") == 0)
+		return tonemap_main(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--server") == 0)
+		return server_main(argc, argv);
+	if (argc >= 2 && strcmp(argv[1], "--worker") == 0)
+		return worker_main(argc, argv);
 
-	auto scene = load_scene(argv[1]);
-	scene.camera.width = strtol(argv[2], nullptr, 10);
-	scene.camera.height = strtol(argv[3], nullptr, 10);
-	scene.samples = strtol(argv[4], nullptr, 10);
-	scene.camera.tan_fov_y = tanf(scene.camera.fov_y * 0.5f);
-	scene.camera.tan_fov_x = scene.camera.tan_fov_y * (float)scene.camera.width / (float)scene.camera.height;
-	scene.ray_depth = 6;
+	RenderJob job;
+	if (!parse_job(argc - 1, argv + 1, job)) {
+		std::cerr << "usage: " << argv[0] << " " << job_usage << std::endl;
+		return 1;
+	}
 
-	auto image = render(scene);
-	std::ofstream out(argv[5]);
+	auto scene = load_scene(job.scene);
+	fprintf(stderr, "loaded %s in %.1f ms, %.1f ms of it parsing JSON\n", job.scene.c_str(), scene.load_ms,
+		scene.parse_ms);
+	if (!job.options.cameras.empty() || job.options.frames > 0)
+		return run_batch(scene, job) ? 0 : 1;
+	Image image(0, 0);
+	if (!run_job(scene, job, image))
+		return 1;
+	std::ofstream out(job.output);
 	image.save(out);
-	out.close();
 	return 0;
-}
\ No newline at end of file
+}
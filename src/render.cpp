@@ -1,29 +1,64 @@
 #include <render.hpp>
 
 #include <geometry_utils.hpp>
+#include <PostProcess.hpp>
 #include <Random.hpp>
 #include <Ray.hpp>
+#include <Sampler.hpp>
 #include <utils.hpp>
 
+#include <cmath>
+#include <functional>
 #include <iostream>
 
 bool
-intersect(const Scene &scene, Ray ray, Intersection &intersection)
+intersect(const Scene &scene, Ray ray, Intersection &intersection, float max_distance = INF,
+	  TraversalStats *stats = nullptr)
 {
 	bool has_intersection = false;
-	float min_distance = INF;
-	for (auto &primitive : scene.planes) {
-		auto intersection_opt = primitive.intersect(ray);
-		if (!intersection_opt.has_value())
+	float min_distance = max_distance;
+	if (stats != nullptr)
+		stats->primitive_tests += scene.planes.size();
+	/*
+	 * Of the planes open on every axis only the nearest along the ray is
+	 * intersected in full. Planes clipped on some axis may miss where their
+	 * equation hits, so each of them nearer than the best hit so far is
+	 * tested in full right away. The resulting distance bounds the BVH
+	 * traversal.
+	 */
+	int nearest_plane = -1;
+	float clipped_distance = max_distance;
+	for (int i = 0; i < (int)scene.plane_equations.size(); i++) {
+		const auto &plane = scene.plane_equations[i];
+		const glm::vec3 normal = plane;
+		float distance = -(glm::dot(normal, ray.origin) + plane.w) / glm::dot(normal, ray.direction);
+		if (!(EPS5 < distance && distance < min_distance))
 			continue;
-		float distance = intersection_opt.value().distance;
-		if (EPS5 < distance && distance < min_distance) {
+		if (!scene.plane_clipped[i]) {
 			min_distance = distance;
+			nearest_plane = i;
+			continue;
+		}
+		auto intersection_opt = scene.planes[i].intersect(ray);
+		if (!intersection_opt.has_value() || !(EPS5 < intersection_opt.value().distance &&
+						       intersection_opt.value().distance < min_distance))
+			continue;
+		min_distance = clipped_distance = intersection_opt.value().distance;
+		intersection = intersection_opt.value();
+		has_intersection = true;
+		nearest_plane = -1;
+	}
+	if (nearest_plane != -1) {
+		auto intersection_opt = scene.planes[nearest_plane].intersect(ray);
+		min_distance = clipped_distance;
+		if (intersection_opt.has_value() && EPS5 < intersection_opt.value().distance &&
+		    intersection_opt.value().distance < clipped_distance) {
+			min_distance = intersection_opt.value().distance;
 			intersection = intersection_opt.value();
 			has_intersection = true;
 		}
 	}
-	auto intersection_opt = scene.bvh.intersect(ray, scene.bvh.root, min_distance, false);//debug);
+	auto intersection_opt = scene.bvh.intersect(ray, scene.bvh.root, min_distance, false, stats);
 	if (!intersection_opt.has_value())
 		return has_intersection;
 	float distance = intersection_opt.value().distance;
@@ -36,37 +71,77 @@ intersect(const Scene &scene, Ray ray, Intersection &intersection)
 }
 
 Color
-raytrace(const Scene &scene, Random &rnd, Ray ray, int depth = 0);
+raytrace(const Scene &scene, Sampler &sampler, Ray ray, int depth = 0, float max_distance = INF,
+	 SampleAovs *aovs = nullptr);
+
+// Light carried by a bounce, split into direct and indirect light when it leaves the first hit.
+static Color
+scatter(Color weight, Color incoming, int depth, SampleAovs *aovs)
+{
+	if (aovs != nullptr && depth == 0) {
+		aovs->direct += weight * aovs->next_emission;
+		aovs->indirect = weight * (incoming - aovs->next_emission);
+	}
+	return weight * incoming;
+}
+
+// Emission reaching the camera directly or from the second path vertex counts as direct light.
+static void
+record_emission(SampleAovs *aovs, int depth, Color emission)
+{
+	if (aovs == nullptr)
+		return;
+	if (depth == 0)
+		aovs->direct = emission;
+	else if (depth == 1)
+		aovs->next_emission = emission;
+}
+
+// std::less orders pointers into the two unrelated arrays, where the built-in operators are unspecified.
+static float
+primitive_index(const Scene &scene, const Primitive *primitive)
+{
+	const std::less<const Primitive*> before;
+	const auto *first = scene.primitives.data(), *last = first + scene.primitives.size();
+	if (!before(primitive, first) && before(primitive, last))
+		return (float)(primitive - first);
+	return (float)(scene.primitives.size() + (primitive - scene.planes.data()));
+}
 
 Color
-diffuse_raytrace(const Scene &scene, Random &rnd,
+diffuse_raytrace(const Scene &scene, Sampler &sampler,
 		 const Primitive *primitive, glm::vec3 point,
-		 glm::vec3 normal, Ray ray, int depth)
+		 glm::vec3 normal, Ray ray, int depth, SampleAovs *aovs)
 {
-	auto w = scene.distribution.sample(rnd, point + EPS5 * normal, normal);
+	auto sample = scene.distribution.sample(sampler, point + EPS5 * normal, normal);
+	auto w = sample.w;
 	auto w_normal_dot = glm::dot(w, normal);
 	if (w_normal_dot < 0.f)
 		return primitive->material.emission;
-	auto p = scene.distribution.pdf(point + EPS5 * normal, normal, w);
+	auto p = sample.pdf;
 	Ray wRay = {w, point + w * EPS5};
 	float f = (p < EPS9) ? INF : 1.f / (PI * p);
-	return primitive->material.emission + f * w_normal_dot * raytrace(scene, rnd, wRay, depth + 1) * primitive->material.color;
+	// Nothing can be hit behind the emitter the direction was aimed at.
+	float max_distance = sample.emitter_distance * (1.f + EPS4) + EPS4;
+	auto incoming = raytrace(scene, sampler, wRay, depth + 1, max_distance, aovs);
+	return primitive->material.emission + scatter(f * w_normal_dot * primitive->material.color, incoming, depth, aovs);
 }
 
 Color
-metallic_raytrace(const Scene &scene, Random &rnd,
+metallic_raytrace(const Scene &scene, Sampler &sampler,
 		  const Primitive *primitive, glm::vec3 point,
-		  glm::vec3 normal, Ray ray, int depth)
+		  glm::vec3 normal, Ray ray, int depth, SampleAovs *aovs)
 {
 	auto reflect_dir = ray.direction - 2.f * normal * glm::dot(normal, ray.direction);
 	Ray reflect_ray = {reflect_dir, point + reflect_dir * EPS5};
-	return primitive->material.emission + raytrace(scene, rnd, reflect_ray, depth + 1) * primitive->material.color;
+	auto incoming = raytrace(scene, sampler, reflect_ray, depth + 1, INF, aovs);
+	return primitive->material.emission + scatter(primitive->material.color, incoming, depth, aovs);
 }
 
 Color
-dielectric_raytrace(const Scene &scene, Random &rnd,
+dielectric_raytrace(const Scene &scene, Sampler &sampler,
 		    const Primitive *primitive, glm::vec3 point,
-		    glm::vec3 normal, Ray ray, bool inside, int depth)
+		    glm::vec3 normal, Ray ray, bool inside, int depth, SampleAovs *aovs)
 {
 	auto normal_ray_dot = glm::dot(normal, ray.direction);
 	auto eta1 = 1.f, eta2 = primitive->material.ior;
@@ -77,66 +152,102 @@ dielectric_raytrace(const Scene &scene, Random &rnd,
 	auto sinTheta2 = eta1 / eta2 * sinTheta1;
 	auto r0 = powf((eta1 - eta2) / (eta1 + eta2), 2.f);
 	auto r = r0 + (1.f - r0) * powf(1.f + normal_ray_dot, 5.f);
-	auto u = rnd.uniform();
+	auto u = sampler.get1d();
 	if (std::abs(sinTheta2) > 1.f || u < r) {
 		auto reflect_dir = ray.direction - 2.f * normal_ray_dot * normal;
 		Ray reflect_ray = {reflect_dir, point + reflect_dir * EPS5};
-		auto reflected = raytrace(scene, rnd, reflect_ray, depth + 1);
-		return primitive->material.emission + reflected;
+		auto reflected = raytrace(scene, sampler, reflect_ray, depth + 1, INF, aovs);
+		return primitive->material.emission + scatter(Color(1.f), reflected, depth, aovs);
 	}
 	auto cosTheta2 = sqrtf(1.f - powf(sinTheta2, 2.f));
 	auto refract_dir = eta1 / eta2 * (ray.direction) + (eta1 / eta2 * cosTheta1 - cosTheta2) * normal;
 	Ray refract_ray = {refract_dir, point + refract_dir * EPS5};
-	auto refracted = raytrace(scene, rnd, refract_ray, depth + 1);
-	if (!inside)
-		refracted *= primitive->material.color;
-	return primitive->material.emission + refracted;
+	auto refracted = raytrace(scene, sampler, refract_ray, depth + 1, INF, aovs);
+	auto weight = inside ? Color(1.f) : primitive->material.color;
+	return primitive->material.emission + scatter(weight, refracted, depth, aovs);
 }
 
 Color
-raytrace(const Scene &scene, Random &rnd, Ray ray, int depth)
+raytrace(const Scene &scene, Sampler &sampler, Ray ray, int depth, float max_distance,
+	 SampleAovs *aovs)
 {
 	if (depth >= scene.ray_depth)
 		return black;
 
 	Intersection intersection{};
-	if (!intersect(scene, ray, intersection))
+	auto stats = (aovs != nullptr) ? &aovs->traversal : nullptr;
+	bool has_intersection = intersect(scene, ray, intersection, max_distance, stats);
+	if (!has_intersection && max_distance < INF)
+		has_intersection = intersect(scene, ray, intersection, INF, stats);
+	if (!has_intersection) {
+		record_emission(aovs, depth, scene.bg_color);
 		return scene.bg_color;
+	}
 	const auto &[distance, point, normal,
 		     inside, primitive] = intersection;
+	record_emission(aovs, depth, primitive->material.emission);
+	if (aovs != nullptr && depth == 0) {
+		aovs->depth = distance;
+		aovs->normal = normal;
+		aovs->albedo = primitive->material.color;
+		aovs->primitive_id = primitive_index(scene, primitive);
+		aovs->material_id = (float)primitive->material_id;
+		aovs->emission = primitive->material.emission;
+	}
 	switch (primitive->material.material) {
 		case (Material::DIFFUSE):
-			return diffuse_raytrace(scene, rnd, primitive, point, normal, ray, depth);
+			return diffuse_raytrace(scene, sampler, primitive, point, normal, ray, depth, aovs);
 		case (Material::METALLIC):
-			return metallic_raytrace(scene, rnd, primitive, point, normal, ray, depth);
+			return metallic_raytrace(scene, sampler, primitive, point, normal, ray, depth, aovs);
 		case (Material::DIELECTRIC):
-			return dielectric_raytrace(scene, rnd, primitive, point, normal, ray, inside, depth);
+			return dielectric_raytrace(scene, sampler, primitive, point, normal, ray, inside, depth, aovs);
 		default:
 			unreachable();
 	}
 }
 
-Image
-render(Scene &scene)
+void
+render(const Scene &scene, Framebuffer &framebuffer, int samples, const Tile &tile)
 {
 	const auto &camera = scene.camera;
-	Image image(camera.height, camera.width);
+	assert(framebuffer.m_height == camera.height && framebuffer.m_width == camera.width);
+	assert(0 <= tile.x0 && tile.x1 <= camera.width && 0 <= tile.y0 && tile.y1 <= camera.height);
+	const int tile_width = tile.x1 - tile.x0;
 
 	#pragma omp parallel for schedule(dynamic,8)
-	for (int pixel = 0; pixel < camera.height * camera.width; pixel++) {
-		//std::cout << pixel << std::endl;
-		Random rnd(pixel);
-		int i = pixel / camera.width;
-		int j = pixel % camera.width;
-		Color color = black;
-		for (int k = 0; k < scene.samples; k++) {
-			float x = (float) j + rnd.uniform();
-			float y = (float) i + rnd.uniform();
+	for (int index = 0; index < tile.area(); index++) {
+		Sampler sampler(scene.sampler_type, scene.samples);
+		int i = tile.y0 + index / tile_width;
+		int j = tile.x0 + index % tile_width;
+		int pixel = i * camera.width + j;
+		int first = (int)framebuffer.sample_count[pixel];
+		for (int k = first; k < first + samples; k++) {
+			sampler.start_sample(pixel, k);
+			auto jitter = sampler.get2d();
+			float x = (float) j + jitter.x;
+			float y = (float) i + jitter.y;
 			auto ray = camera.ray_throw(x, y);
-			color += raytrace(scene, rnd, ray, 0);
+			if (framebuffer.aov_mask != 0) {
+				SampleAovs aovs;
+				auto color = raytrace(scene, sampler, ray, 0, INF, &aovs);
+				framebuffer.add_sample(pixel, color, &aovs);
+			} else {
+				framebuffer.add_sample(pixel, raytrace(scene, sampler, ray, 0));
+			}
 		}
-		color /= (float) scene.samples;
-		image.set_pixel(i, j, gamma_corrected(aces_tonemap(color)));
 	}
-	return image;
-}
\ No newline at end of file
+}
+
+void
+render(const Scene &scene, Framebuffer &framebuffer, int samples)
+{
+	render(scene, framebuffer, samples, Tile{0, 0, framebuffer.m_width, framebuffer.m_height});
+}
+
+Image
+render(Scene &scene)
+{
+	Framebuffer framebuffer(scene.camera.height, scene.camera.width);
+	render(scene, framebuffer, scene.samples);
+	return tonemap(framebuffer);
+}